@@ -0,0 +1,218 @@
+#include "corpus_generator.hpp"
+
+#include <array>
+
+namespace mt::bench {
+
+namespace {
+
+// splitmix64, chosen over <random> distributions since those aren't
+// guaranteed to produce the same numbers across standard libraries
+class Random {
+public:
+  explicit Random(uint64_t seed)
+      : m_state(seed) {
+  }
+
+  uint64_t next() {
+    uint64_t z = (m_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  size_t below(size_t bound) {
+    return static_cast<size_t>(next() % bound);
+  }
+
+private:
+  uint64_t m_state;
+};
+
+constexpr std::array<std::string_view, 24> words = {
+    "lorem",     "ipsum",   "dolor",    "sit",       "amet",   "consectetur",
+    "adipiscing", "elit",   "sed",      "do",        "eiusmod", "tempor",
+    "incididunt", "ut",     "labore",   "et",        "dolore", "magna",
+    "aliqua",    "transpiler", "token", "renderer",  "parser", "markdown"};
+
+void append_words(std::string &out, Random &random, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (i != 0)
+      out += ' ';
+    out += words[random.below(words.size())];
+  }
+}
+
+void append_prose(std::string &out, Random &random) {
+  size_t sentences = 4 + random.below(12);
+  for (size_t i = 0; i < sentences; ++i) {
+    append_words(out, random, 6 + random.below(14));
+    switch (random.below(6)) {
+    case 0:
+      out += " **";
+      append_words(out, random, 2);
+      out += "**";
+      break;
+    case 1:
+      out += " *";
+      append_words(out, random, 1);
+      out += '*';
+      break;
+    case 2:
+      out += " `";
+      append_words(out, random, 1);
+      out += '`';
+      break;
+    default:
+      break;
+    }
+    out += ".\n";
+  }
+  out += '\n';
+}
+
+void append_nested_list(std::string &out, Random &random) {
+  size_t items = 8 + random.below(24);
+  size_t depth = 0;
+  for (size_t i = 0; i < items; ++i) {
+    out.append(depth * 2, ' ');
+    out += (random.below(2) == 0) ? "- " : "* ";
+    append_words(out, random, 3 + random.below(8));
+    out += '\n';
+
+    size_t step = random.below(3);
+    if (step == 0 && depth < 12)
+      depth++;
+    else if (step == 1 && depth > 0)
+      depth--;
+  }
+  out += '\n';
+}
+
+void append_nested_quote(std::string &out, Random &random) {
+  size_t depth = 1 + random.below(16);
+  size_t lines = 2 + random.below(6);
+  for (size_t i = 0; i < lines; ++i) {
+    for (size_t level = 0; level < depth; ++level)
+      out += "> ";
+    append_words(out, random, 5 + random.below(10));
+    out += '\n';
+  }
+  out += '\n';
+}
+
+void append_code_fence(std::string &out, Random &random) {
+  out += "```cpp\n";
+  size_t lines = 40 + random.below(400);
+  for (size_t i = 0; i < lines; ++i) {
+    out.append(random.below(4) * 2, ' ');
+    out += "if (a < b && c > d) { std::cout << \"";
+    append_words(out, random, 2);
+    out += "\"; } // ";
+    append_words(out, random, 3);
+    out += '\n';
+  }
+  out += "```\n\n";
+}
+
+void append_links_images(std::string &out, Random &random) {
+  size_t count = 6 + random.below(20);
+  for (size_t i = 0; i < count; ++i) {
+    if (random.below(3) == 0) {
+      out += "![";
+      append_words(out, random, 2);
+      out += "](https://example.com/img/";
+    } else {
+      out += '[';
+      append_words(out, random, 3);
+      out += "](https://example.com/page/";
+    }
+    out += words[random.below(words.size())];
+    out += "?id=";
+    out += std::to_string(random.below(100000));
+    out += ") ";
+    append_words(out, random, 4);
+    out += ' ';
+  }
+  out += "\n\n";
+}
+
+void append_pathological(std::string &out, Random &random) {
+  static constexpr std::array<std::string_view, 4> openers = {
+      "*", "[", "`", "**"};
+  size_t runs = 200 + random.below(400);
+  for (size_t i = 0; i < runs; ++i) {
+    out += openers[random.below(openers.size())];
+    out += words[random.below(words.size())];
+    out += ' ';
+  }
+  out += "\n\n";
+}
+
+} // namespace
+
+std::string_view corpus_name(CorpusKind kind) {
+  switch (kind) {
+  case CorpusKind::PROSE:
+    return "prose";
+  case CorpusKind::NESTED_LISTS:
+    return "nested_lists";
+  case CorpusKind::NESTED_QUOTES:
+    return "nested_quotes";
+  case CorpusKind::CODE_FENCES:
+    return "code_fences";
+  case CorpusKind::LINKS_IMAGES:
+    return "links_images";
+  case CorpusKind::PATHOLOGICAL:
+    return "pathological";
+  }
+  return "unknown";
+}
+
+const std::vector<CorpusKind> &all_corpus_kinds() {
+  static const std::vector<CorpusKind> kinds = {CorpusKind::PROSE,
+                                                CorpusKind::NESTED_LISTS,
+                                                CorpusKind::NESTED_QUOTES,
+                                                CorpusKind::CODE_FENCES,
+                                                CorpusKind::LINKS_IMAGES,
+                                                CorpusKind::PATHOLOGICAL};
+  return kinds;
+}
+
+Corpus generate_corpus(CorpusKind kind, size_t target_size, uint64_t seed) {
+  Random random(seed ^ (static_cast<uint64_t>(kind) << 56));
+  std::string source;
+  source.reserve(target_size + 4096);
+
+  while (source.size() < target_size) {
+    // Every document is split into sections like a real one would be
+    source += "## ";
+    append_words(source, random, 3);
+    source += "\n\n";
+
+    switch (kind) {
+    case CorpusKind::PROSE:
+      append_prose(source, random);
+      break;
+    case CorpusKind::NESTED_LISTS:
+      append_nested_list(source, random);
+      break;
+    case CorpusKind::NESTED_QUOTES:
+      append_nested_quote(source, random);
+      break;
+    case CorpusKind::CODE_FENCES:
+      append_code_fence(source, random);
+      break;
+    case CorpusKind::LINKS_IMAGES:
+      append_links_images(source, random);
+      break;
+    case CorpusKind::PATHOLOGICAL:
+      append_pathological(source, random);
+      break;
+    }
+  }
+
+  return Corpus{kind, corpus_name(kind), std::move(source)};
+}
+
+} // namespace mt::bench
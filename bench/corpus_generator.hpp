@@ -0,0 +1,36 @@
+/*
+  Corpus Generator: builds deterministic synthetic Markdown documents
+  stressing different parts of the transpiler
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mt::bench {
+
+enum class CorpusKind {
+  PROSE,
+  NESTED_LISTS,
+  NESTED_QUOTES,
+  CODE_FENCES,
+  LINKS_IMAGES,
+  PATHOLOGICAL
+};
+
+struct Corpus {
+  CorpusKind kind;
+  std::string_view name;
+  std::string source;
+};
+
+std::string_view corpus_name(CorpusKind kind);
+const std::vector<CorpusKind> &all_corpus_kinds();
+
+// The same (kind, target_size, seed) always yields the same document
+Corpus generate_corpus(CorpusKind kind, size_t target_size, uint64_t seed);
+
+} // namespace mt::bench
@@ -0,0 +1,293 @@
+/*
+  mt_bench: measures the throughput of every transpiling stage over
+  synthetic corpora
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "block_parser.hpp"
+#include "corpus_generator.hpp"
+#include "html_renderer.hpp"
+#include "inline_parser.hpp"
+#include "lexer.hpp"
+#include "node.hpp"
+#include "simd.hpp"
+#include "transpile_context.hpp"
+#include "visitor.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  size_t size_kb = 4096;
+  size_t iterations = 5;
+  uint64_t seed = 1;
+  std::string json_path;
+  std::string only_corpus;
+};
+
+struct StageResult {
+  std::string_view name;
+  double seconds = std::numeric_limits<double>::max();
+};
+
+struct CorpusResult {
+  std::string_view name;
+  size_t bytes = 0;
+  size_t tokens = 0;
+  size_t output_bytes = 0;
+  std::vector<StageResult> stages;
+  long peak_rss_kb = 0;
+};
+
+long peak_rss_kb() {
+#if defined(__unix__) || defined(__APPLE__)
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+#else
+  return 0;
+#endif
+}
+
+// Collects the token ranges, which the block parser hands to the inline
+// parser, so that the inline stage can be timed on its own
+class InlineSpanCollector : public mt::Visitor {
+public:
+  std::vector<mt::TokenRange> spans;
+
+  void visit(const mt::Document &node) override {
+    visit_children(node);
+  }
+  void visit(const mt::Paragraph &node) override {
+    spans.emplace_back(node.tokens);
+  }
+  void visit(const mt::Heading &node) override {
+    spans.emplace_back(node.tokens);
+  }
+  void visit(const mt::CodeSpan &) override {
+  }
+  void visit(const mt::Text &) override {
+  }
+  void visit(const mt::Emphasis &) override {
+  }
+  void visit(const mt::StrongEmphasis &) override {
+  }
+  void visit(const mt::Link &) override {
+  }
+  void visit(const mt::Image &) override {
+  }
+  void visit(const mt::InlineCode &) override {
+  }
+  void visit(const mt::List &node) override {
+    visit_children(node);
+  }
+  void visit(const mt::ListItem &node) override {
+    visit_children(node);
+  }
+  void visit(const mt::BlockQuote &node) override {
+    visit_children(node);
+  }
+
+private:
+  void visit_children(const mt::Node &node) {
+    for (const mt::Node &child : node.children())
+      child.accept(*this);
+  }
+};
+
+template <typename Function>
+double time_seconds(Function &&function) {
+  auto start = Clock::now();
+  function();
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+CorpusResult run_corpus(const mt::bench::Corpus &corpus,
+                        const Options &options) {
+  CorpusResult result;
+  result.name = corpus.name;
+  result.bytes = corpus.source.size();
+  result.stages = {
+      {"lex"}, {"block_parse"}, {"inline_parse"}, {"render"}, {"total"}};
+
+  mt::HtmlRenderer renderer(std::string(corpus.name));
+  mt::TranspileContext context(mt::RenderOptions{std::string(corpus.name)});
+
+  // Like the context, every iteration reuses the arena of the same Document
+  mt::Document document;
+  mt::Document inline_document;
+  mt::InlineParser inline_parser;
+
+  for (size_t iteration = 0; iteration < options.iterations; ++iteration) {
+    mt::Lexer lexer(corpus.source);
+    mt::TokenStream tokens;
+    double lex = time_seconds([&] { tokens = lexer.tokenize(); });
+    result.tokens = tokens.size();
+
+    double parse = time_seconds([&] {
+      mt::BlockParser parser(tokens);
+      parser.parse(document);
+    });
+
+    InlineSpanCollector collector;
+    document.accept(collector);
+    inline_document.clear();
+    double inline_parse = time_seconds([&] {
+      for (auto span : collector.spans) {
+        auto *paragraph = inline_document.add<mt::Paragraph>(inline_document);
+        inline_parser.parse(span, *paragraph, inline_document);
+      }
+    });
+
+    double render = time_seconds([&] {
+      result.output_bytes = renderer.render(document).size();
+    });
+
+    double total = time_seconds([&] { context.render(corpus.source); });
+
+    double timings[] = {lex, parse, inline_parse, render, total};
+    for (size_t stage = 0; stage < result.stages.size(); ++stage)
+      result.stages[stage].seconds =
+          std::min(result.stages[stage].seconds, timings[stage]);
+  }
+
+  result.peak_rss_kb = peak_rss_kb();
+  return result;
+}
+
+double mb_per_second(const CorpusResult &result, const StageResult &stage) {
+  return stage.seconds > 0
+             ? static_cast<double>(result.bytes) / (1024.0 * 1024.0) /
+                   stage.seconds
+             : 0.0;
+}
+
+double ns_per_token(const CorpusResult &result, const StageResult &stage) {
+  return result.tokens > 0
+             ? stage.seconds * 1e9 / static_cast<double>(result.tokens)
+             : 0.0;
+}
+
+void print_table(const std::vector<CorpusResult> &results) {
+  std::cout << "instruction set: " << mt::simd::active_instruction_set()
+            << '\n';
+  for (const auto &result : results) {
+    std::cout << result.name << " (" << result.bytes << " bytes, "
+              << result.tokens << " tokens, " << result.output_bytes
+              << " output bytes, peak RSS " << result.peak_rss_kb << " KiB)\n";
+    for (const auto &stage : result.stages) {
+      std::cout << "  " << stage.name;
+      std::cout << std::string(14 - stage.name.size(), ' ');
+      std::cout << mb_per_second(result, stage) << " MB/s  "
+                << ns_per_token(result, stage) << " ns/token\n";
+    }
+  }
+}
+
+std::string to_json(const std::vector<CorpusResult> &results,
+                    const Options &options) {
+  std::ostringstream json;
+  json << "{\n  \"version\": 1,\n";
+  json << "  \"iterations\": " << options.iterations << ",\n";
+  json << "  \"seed\": " << options.seed << ",\n";
+  json << "  \"instruction_set\": \"" << mt::simd::active_instruction_set()
+       << "\",\n";
+  json << "  \"peak_rss_kb\": " << peak_rss_kb() << ",\n";
+  json << "  \"corpora\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto &result = results[i];
+    json << (i == 0 ? "\n" : ",\n");
+    json << "    {\n      \"name\": \"" << result.name << "\",\n";
+    json << "      \"bytes\": " << result.bytes << ",\n";
+    json << "      \"tokens\": " << result.tokens << ",\n";
+    json << "      \"output_bytes\": " << result.output_bytes << ",\n";
+    json << "      \"peak_rss_kb\": " << result.peak_rss_kb << ",\n";
+    json << "      \"stages\": {";
+    for (size_t s = 0; s < result.stages.size(); ++s) {
+      const auto &stage = result.stages[s];
+      json << (s == 0 ? "\n" : ",\n");
+      json << "        \"" << stage.name << "\": {\"seconds\": "
+           << stage.seconds
+           << ", \"mb_per_s\": " << mb_per_second(result, stage)
+           << ", \"ns_per_token\": " << ns_per_token(result, stage) << "}";
+    }
+    json << "\n      }\n    }";
+  }
+  json << "\n  ]\n}\n";
+  return json.str();
+}
+
+bool parse_options(int argc, char *argv[], Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--size-kb" && has_value) {
+      options.size_kb = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--iterations" && has_value) {
+      options.iterations = std::max<size_t>(
+          1, std::strtoull(argv[++i], nullptr, 10));
+    } else if (arg == "--seed" && has_value) {
+      options.seed = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--json" && has_value) {
+      options.json_path = argv[++i];
+    } else if (arg == "--corpus" && has_value) {
+      options.only_corpus = argv[++i];
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--size-kb N] [--iterations N] [--seed N]"
+                << " [--corpus NAME] [--json OUTPUT_FILE]\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, options))
+    return 1;
+
+  std::vector<CorpusResult> results;
+  for (auto kind : mt::bench::all_corpus_kinds()) {
+    if (!options.only_corpus.empty() &&
+        options.only_corpus != mt::bench::corpus_name(kind))
+      continue;
+
+    auto corpus = mt::bench::generate_corpus(
+        kind, options.size_kb * 1024, options.seed);
+    results.push_back(run_corpus(corpus, options));
+  }
+
+  print_table(results);
+
+  if (!options.json_path.empty()) {
+    std::ofstream json_file(options.json_path);
+    if (!json_file.is_open()) {
+      std::cerr << "Error: Could not open output file: " << options.json_path
+                << "\n";
+      return 1;
+    }
+    json_file << to_json(results, options);
+  }
+
+  return 0;
+}
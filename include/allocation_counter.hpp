@@ -0,0 +1,26 @@
+/*
+  Allocation Counter: heap allocation totals of every thread, fed by the
+  operator new replacements in allocation_hooks.cpp when those are linked
+  into the binary
+*/
+#pragma once
+
+#include <cstddef>
+
+namespace mt::allocation_counter {
+
+struct Snapshot {
+  size_t count = 0;
+  size_t bytes = 0;
+};
+
+// Totals of the calling thread
+Snapshot snapshot();
+
+// False when the hooks aren't linked in, in which case the totals stay 0
+bool enabled();
+
+void enable();
+void record(size_t bytes);
+
+} // namespace mt::allocation_counter
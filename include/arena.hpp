@@ -0,0 +1,74 @@
+/*
+  Arena: monotonic allocator handing out memory by bumping a pointer through
+  blocks it owns. Everything allocated from it is released at once, by
+  resetting or destroying the arena, and never destroyed one by one
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mt {
+
+class Arena {
+public:
+  explicit Arena(size_t initial_block_size = 16 * 1024);
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  Arena(Arena &&other) noexcept = default;
+  Arena &operator=(Arena &&other) noexcept = default;
+
+  void *allocate(size_t size, size_t alignment);
+
+  // Objects are never destroyed, so they can't own anything themselves
+  template <typename T, typename... Args>
+  T *create(Args &&...args) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "Arena objects are never destroyed");
+    return new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+
+  template <typename T>
+  std::span<T> copy(std::span<const T> values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (values.empty())
+      return {};
+    T *copied = static_cast<T *>(allocate(values.size_bytes(), alignof(T)));
+    std::memcpy(copied, values.data(), values.size_bytes());
+    return {copied, values.size()};
+  }
+
+  std::string_view copy(std::string_view text);
+
+  // Releases everything allocated at once, keeping the blocks for reuse
+  void reset();
+
+  // Bytes held in blocks, used or not
+  size_t capacity() const;
+
+private:
+  struct Block {
+    std::unique_ptr<std::byte[]> data;
+    size_t size;
+  };
+
+  void *allocate_from_next_block(size_t size, size_t alignment);
+
+private:
+  std::vector<Block> m_blocks;
+  size_t m_block = 0;
+  std::byte *m_position = nullptr;
+  std::byte *m_block_end = nullptr;
+  size_t m_next_block_size;
+};
+
+} // namespace mt
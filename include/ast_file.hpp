@@ -0,0 +1,40 @@
+/*
+  AST File: a parsed document saved as the records and strings of its flat
+  tree, see FlatDocument::save(). Opening one maps it and views its strings
+  in place, so a cached parse renders without lexing or parsing again
+*/
+#pragma once
+
+#include <string>
+
+#include "flat_document.hpp"
+#include "input_file.hpp"
+
+namespace mt {
+
+class AstFile {
+public:
+  AstFile() = default;
+
+  AstFile(const AstFile &) = delete;
+  AstFile &operator=(const AstFile &) = delete;
+
+  // Writes the flat tree of a parsed document, such as Document::flat, to
+  // the file. Returns false when it can't be written
+  static bool save(const FlatDocument &document, const std::string &path);
+
+  // Returns false when the file can't be read or isn't an AST file of this
+  // format version
+  bool open(const std::string &path);
+  void close();
+
+  // Valid until the file is closed or reopened, for HtmlRenderer::render()
+  // or any FlatWalker
+  const FlatDocument &document() const;
+
+private:
+  InputFile m_file;
+  FlatDocument m_document;
+};
+
+} // namespace mt
@@ -0,0 +1,117 @@
+/*
+  Batch Transpiler: transpiles every Markdown file of a directory tree into
+  the same layout under another directory, on a pool of threads which
+  take the largest files first and steal work from each other once their
+  own runs out
+*/
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "budget.hpp"
+#include "build_cache.hpp"
+#include "stats.hpp"
+#include "transpile_context.hpp"
+
+namespace mt {
+
+struct BatchSummary {
+  size_t file_count = 0;
+  size_t failed_count = 0;
+  // Files which hit one of the limits
+  size_t limited_count = 0;
+  // Files skipped as their output was up to date
+  size_t cached_count = 0;
+  size_t input_bytes = 0;
+  size_t output_bytes = 0;
+  double seconds = 0.0;
+
+  void add(const BatchSummary &other);
+};
+
+class BatchTranspiler {
+public:
+  // A job count of 0 picks one thread per core. The title of every page is
+  // the name of its file
+  explicit BatchTranspiler(RenderOptions options, size_t job_count = 0);
+
+  // Transpiles the .md and .markdown files under the input directory into
+  // .html files under the output directory. Returns false when the input
+  // directory can't be walked, files which fail are counted in the summary
+  bool transpile(const std::string &input_directory,
+                 const std::string &output_directory);
+  // Transpiles only the given files of the input directory, and the files
+  // under the given directories, into the output directory. Returns false
+  // when one of those directories can't be walked
+  bool transpile(const std::string &input_directory,
+                 const std::string &output_directory,
+                 const std::vector<std::filesystem::path> &inputs);
+
+  // Figures of the last transpile()
+  const BatchSummary &summary() const;
+
+  // When set, every following transpile() adds the figures of all of its
+  // files into the stats, the stage times of the threads adding up
+  void set_stats(TranspileStats *stats);
+
+  // When set, files whose output is up to date in the cache are skipped
+  void set_cache(const BuildCache *cache);
+
+private:
+  struct Job {
+    std::filesystem::path input;
+    std::filesystem::path output;
+    size_t size;
+  };
+
+  // Jobs of one thread, which takes them from the front while the others
+  // steal from the back
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  // Buffers of one thread, kept between files
+  struct Worker {
+    explicit Worker(const RenderOptions &options);
+
+    TranspileContext context;
+    TranspileStats stats;
+    BatchSummary summary;
+  };
+
+  bool find_jobs(const std::filesystem::path &input_directory,
+                 const std::filesystem::path &output_directory,
+                 const std::filesystem::path &directory,
+                 std::vector<Job> &jobs);
+  void add_job(const std::filesystem::path &input_directory,
+               const std::filesystem::path &output_directory,
+               const std::filesystem::directory_entry &entry,
+               std::vector<Job> &jobs);
+  void run_jobs(std::vector<Job> jobs);
+  void work(size_t worker_index);
+  bool next_job(size_t worker_index, Job &job);
+  bool transpile_file(Worker &worker, const Job &job);
+  void report_error(std::string_view message, const std::string &path);
+
+private:
+  RenderOptions m_options;
+  size_t m_job_count;
+  TranspileStats *m_stats;
+  const BuildCache *m_cache;
+  BatchSummary m_summary;
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  // Keeps the errors of the threads on lines of their own
+  std::mutex m_error_mutex;
+};
+
+} // namespace mt
@@ -1,51 +1,164 @@
 /*
   Block Parser: divides and groups tokens into Nodes, that
   represent Markdown blocks and assigns those Nodes their inline tokens for
-  further inline parsing
+  further inline parsing. The tokens are walked once, line by line, matching
+  every line against a stack of the currently open containers
 */
 #pragma once
 
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <string_view>
 #include <vector>
 
+#include "arena.hpp"
+#include "budget.hpp"
+#include "inline_parser.hpp"
 #include "node.hpp"
 #include "token.hpp"
+#include "token_stream.hpp"
 
 namespace mt {
 
 class BlockParser {
 public:
-  explicit BlockParser(const std::vector<Token> &tokens);
+  // Parses the tokens at indices [begin, end) as a whole document
+  explicit BlockParser(const TokenStream &tokens, size_t begin = 0,
+                       size_t end = std::numeric_limits<size_t>::max());
 
   std::unique_ptr<Document> parse();
+  // Parses into an existing document, reusing the memory of its arena
+  void parse(Document &document);
+
+  // Token index of the first token of every top-level block of the last
+  // parsed Document, in the order of its children
+  const std::vector<size_t> &block_starts() const;
+
+  // Enforces the budget's depth, token and deadline limits, see Budget
+  void set_budget(Budget *budget);
+  // Whether the last parse stopped at a limit, its last top-level block
+  // then holding the rest of the input as text
+  bool stopped() const;
+  // Source offset of the rest of the input held by that last block
+  size_t stop_offset() const;
 
 private:
-  // The main dispatching function
-  std::unique_ptr<Node> parse_block_dispatch();
-  // Individual block parsers
-  std::unique_ptr<Paragraph> parse_paragraph();
-  std::unique_ptr<Heading> parse_header();
-  std::unique_ptr<CodeSpan> parse_code_span();
-  std::unique_ptr<BlockQuote> parse_quote();
-  // List related
-  std::unique_ptr<List> parse_list(size_t indent = 0);
-  std::unique_ptr<Node> parse_list_item();
-  size_t count_list_indentation(size_t &index_offset) const;
+  enum class ContainerKind : uint8_t { DOCUMENT, QUOTE, LIST, LIST_ITEM };
+
+  struct Container {
+    ContainerKind kind;
+    Node *node;
+    // Index of its record in the document's flat tree
+    uint32_t record;
+    // Lists and items: the indentation of their marker
+    size_t marker_indentation = 0;
+    // Items: the indentation of their content, stripped from code lines
+    size_t content_indentation = 0;
+  };
+
+  // Line by line parsing
+  void parse_line();
+  size_t match_containers();
+  bool match_quote_marker();
+  void parse_block_starts();
+  bool is_block_start() const;
+  void limit_tokens();
+  bool can_nest(size_t container_count);
+  void add_remaining_text(size_t end);
+
+  // Containers
+  uint32_t add_block(Node *block, size_t block_start);
+  void open_container(ContainerKind kind, Node *node,
+                      size_t block_start, size_t marker_indentation = 0,
+                      size_t content_indentation = 0);
+  void close_containers(size_t depth);
+  void open_list_item(size_t marker_indentation);
+
+  // Leaf blocks
+  bool parse_header(size_t block_start);
+  void open_paragraph();
+  void add_paragraph_line();
+  void close_paragraph();
+  void open_code_span();
+  void add_code_line();
+  bool is_code_span_fence() const;
+  void close_leaf();
+
+  // Lines
+  size_t count_indentation(size_t &index_offset) const;
+  bool is_list_marker(size_t index_offset) const;
+  bool is_blank_line() const;
+  void skip_whitespace();
+  void skip_line();
+  size_t line_end() const;
+  size_t source_offset(size_t index) const;
 
   /* --- */
   bool at_end(size_t offset = 0) const;
-  bool is_line_start() const;
 
   bool check_current_type(TokenType type) const;
 
-  const Token &current_token() const;
-  const Token &peek(size_t index_offset) const;
+  Token current_token() const;
+  Token peek(size_t index_offset) const;
 
   void advance(size_t index = 1);
 
 private:
-  const std::vector<Token> &m_tokens;
+  enum class LeafKind : uint8_t { NONE, PARAGRAPH, CODE_SPAN };
+
+  const TokenStream &m_tokens;
+  size_t m_begin;
+  size_t m_end;
   size_t m_index;
+  std::vector<size_t> m_block_starts;
+
+  // Open containers, from the document down to the innermost one
+  std::vector<Container> m_containers;
+
+  // The open leaf block, always a child of the innermost container
+  LeafKind m_leaf_kind;
+  Paragraph *m_paragraph;
+  uint32_t m_paragraph_record;
+  CodeSpan *m_code_span;
+  // Paragraph tokens: [m_leaf_begin, m_leaf_end) while its lines follow each
+  // other in the stream, gathered into m_leaf_indices once they do not
+  size_t m_leaf_begin;
+  size_t m_leaf_end;
+  bool m_leaf_gathered;
+  std::vector<uint32_t> m_leaf_indices;
+  // Code: its slices so far and the source offset of the new line closing
+  // its last line
+  std::vector<std::string_view> m_code;
+  size_t m_code_new_line;
+
+  InlineParser m_inline_parser;
+  Document *m_document;
+
+  Budget *m_budget;
+  bool m_stopped;
+  size_t m_stop_offset;
+};
+
+// Follows the lines of a document from its start, telling before which of
+// them it can be split into parts that parse into the same top-level blocks
+// as the whole: lines starting a top-level block at their first column,
+// other than a list item, after a blank line and outside of top-level code
+// spans. Every open block is closed by then
+class SplitScanner {
+public:
+  // Offsets of the lines the markdown can be split before, at least
+  // part_size bytes apart
+  static std::vector<size_t> split_points(std::string_view markdown,
+                                          size_t part_size);
+
+  bool can_split_before(std::string_view line) const;
+  // Moves past the line, given without its new line
+  void add_line(std::string_view line);
+
+private:
+  bool m_in_code_span = false;
+  bool m_after_blank_line = false;
 };
 
 } // namespace mt
@@ -0,0 +1,72 @@
+/*
+  Budget: limits on the work a single transpilation may spend on untrusted
+  input. Once a limit is hit, the rest of the input is rendered as escaped
+  text (or, for the output limit, left out) and the status tells which
+*/
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace mt {
+
+// Every limit of 0 is disabled
+struct Limits {
+  // Containers nested in each other, and separately inline elements
+  size_t max_depth = 0;
+  // Tokens parsed into blocks
+  size_t max_tokens = 0;
+  // Bytes of a rendered page, besides the tags closing it
+  size_t max_output_bytes = 0;
+  // Wall-clock time of a transpilation, checked between lines
+  std::chrono::milliseconds deadline{0};
+
+  bool any() const {
+    return max_depth || max_tokens || max_output_bytes || deadline.count();
+  }
+};
+
+enum class Status : uint8_t {
+  OK,
+  DEPTH_LIMIT,
+  TOKEN_LIMIT,
+  OUTPUT_LIMIT,
+  DEADLINE
+};
+
+std::string_view status_name(Status status);
+
+// Keeps track of the limits during one transpilation
+class Budget {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit Budget(Limits limits = {});
+
+  // Starts a new transpilation: the deadline counts from now on, and the
+  // status and token count are forgotten
+  void start();
+
+  const Limits &limits() const;
+
+  // Records the first limit hit, later ones are ignored
+  void exceed(Status status);
+  Status status() const;
+
+  // Whether the deadline passed, exceeding it if so
+  bool expired();
+
+  // Tokens left to parse, for transpilations parsing their input in parts
+  size_t remaining_tokens() const;
+  void add_tokens(size_t count);
+
+private:
+  Limits m_limits;
+  Clock::time_point m_deadline;
+  Status m_status;
+  size_t m_tokens;
+};
+
+} // namespace mt
@@ -0,0 +1,70 @@
+/*
+  Build Cache: remembers which input every output file was rendered from,
+  so that unchanged inputs can be skipped. The key of a page hashes its
+  Markdown, the options it's rendered with, the transpiler's version and
+  the revision of its rendering.
+  Every output file has an entry of its own in the cache directory,
+  replaced at once, so that concurrent threads and processes can share
+  the cache without locking it. The entries are also kept in memory, for
+  processes which look them up again and again
+*/
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "budget.hpp"
+#include "transpile_context.hpp"
+
+namespace mt {
+
+class BuildCache {
+public:
+  static constexpr std::string_view default_directory = ".mtcache";
+
+  // With an empty directory, the entries are only kept in memory
+  explicit BuildCache(std::filesystem::path directory =
+                          std::filesystem::path(default_directory));
+
+  // Key of the page rendered from the Markdown with the options
+  static uint64_t key(std::string_view markdown, const RenderOptions &options);
+
+  // Whether the output file was rendered with the key and hasn't changed
+  // since, giving the status that rendering ended with
+  bool lookup(const std::filesystem::path &output, uint64_t key,
+              Status &status) const;
+  // Records the output file as just rendered with the key, or forgets it
+  // when the deadline was hit. Returns false when the cache can't be
+  // written, which only costs a later rebuild
+  bool store(const std::filesystem::path &output, uint64_t key,
+             Status status) const;
+
+  const std::filesystem::path &directory() const;
+
+private:
+  struct Entry {
+    uint64_t key = 0;
+    Status status = Status::OK;
+    uintmax_t size = 0;
+    long long time = 0;
+  };
+
+  bool read_entry(const std::string &output_path, Entry &entry) const;
+  bool write_entry(const std::string &output_path, const Entry &entry) const;
+  std::filesystem::path entry_path(const std::string &output) const;
+
+private:
+  std::filesystem::path m_directory;
+  // Entries by absolute output path, shared by the threads
+  mutable std::mutex m_mutex;
+  mutable std::unordered_map<std::string, Entry> m_entries;
+};
+
+// 64-bit hash of the bytes, 8 of them at a time
+uint64_t hash_bytes(std::string_view data, uint64_t seed = 0);
+
+} // namespace mt
@@ -0,0 +1,89 @@
+/*
+  Editable Document: Markdown kept parsed and rendered across edits, for
+  live previews. The text is held in parts split before independent
+  top-level blocks (see SplitScanner), each with its own tokens, tree and
+  HTML. An edit re-parses only the parts it touches, grown until they end
+  where the untouched parts can begin again, so a fence, list or quote
+  opened or closed by the edit takes in what it now spans
+*/
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "html_renderer.hpp"
+#include "lexer.hpp"
+#include "node.hpp"
+#include "output_sink.hpp"
+#include "token_stream.hpp"
+#include "transpile_context.hpp"
+
+namespace mt {
+
+// Top-level blocks replaced by an edit: the blocks [first, first +
+// removed_count) before it are [first, first + added_count) after it
+struct EditedBlocks {
+  size_t first = 0;
+  size_t removed_count = 0;
+  size_t added_count = 0;
+};
+
+class EditableDocument {
+public:
+  // Parts are split once they're at least this long
+  static constexpr size_t default_part_size = 16 * 1024;
+
+  // The limits of the options aren't applied, edited documents being
+  // trusted
+  explicit EditableDocument(RenderOptions options = {},
+                            size_t part_size = default_part_size);
+
+  // Replaces the whole text, parsing all of it
+  void set_text(std::string_view markdown);
+  // Replaces the bytes [begin, end) of the text (clamped to it) with the
+  // replacement
+  EditedBlocks edit(size_t begin, size_t end, std::string_view replacement);
+
+  std::string text() const;
+  size_t size() const;
+
+  // The same HTML as TranspileContext::render() gives for the text, put
+  // together from the HTML of the parts
+  std::string render();
+  bool render(OutputSink &output);
+
+  // The tree of each part, its top-level blocks following those of the
+  // part before it
+  size_t part_count() const;
+  const Document &part(size_t index) const;
+
+private:
+  struct Part {
+    std::string source;
+    TokenStream tokens;
+    Document document;
+    size_t block_count = 0;
+    std::string html;
+  };
+
+  std::unique_ptr<Part> parse_part(std::string source);
+  // Replaces the parts [first, last) by the given text, split anew
+  size_t replace_parts(size_t first, size_t last, std::string_view text);
+  // Index of the part holding the offset, the last one for the text's end
+  size_t find_part(size_t offset) const;
+  size_t block_count(size_t first, size_t last) const;
+
+private:
+  Lexer m_lexer;
+  HtmlRenderer m_renderer;
+  size_t m_part_size;
+
+  std::vector<std::unique_ptr<Part>> m_parts;
+  // Offset of every part in the text, and the text's size last
+  std::vector<size_t> m_part_offsets;
+};
+
+} // namespace mt
@@ -0,0 +1,51 @@
+/*
+  File Watcher: waits for the files of directories to be written, through
+  inotify on Linux. A burst of writes, such as an editor saving through a
+  temporary file, is gathered into a single change
+*/
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+namespace mt {
+
+class FileWatcher {
+public:
+  FileWatcher();
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+
+  // Watches the files of the directory, and of the directories under it
+  // when recursive, new ones included. Returns false when it can't be
+  // watched, always on systems without inotify
+  bool watch(const std::filesystem::path &directory, bool recursive);
+
+  // Waits for files to be written or moved in, then for the quiet period
+  // to pass without any more, giving the paths changed. A directory stands
+  // for every file under it, when they could have been missed: directories
+  // moved in and events the kernel dropped. Returns false when waiting
+  // fails
+  bool wait(std::vector<std::filesystem::path> &changed,
+            std::chrono::milliseconds quiet_period);
+
+private:
+  struct Directory {
+    std::filesystem::path path;
+    bool recursive;
+  };
+
+  bool add_watch(const std::filesystem::path &directory, bool recursive);
+  bool read_events(std::vector<std::filesystem::path> &changed);
+
+private:
+  int m_descriptor;
+  // Watched directories by watch descriptor
+  std::unordered_map<int, Directory> m_directories;
+};
+
+} // namespace mt
@@ -0,0 +1,79 @@
+/*
+  Flat Document: the AST laid out as a contiguous preorder array of compact
+  records, which the renderer walks linearly instead of visiting every node
+  through a virtual call. The parsers append the records while creating
+  the nodes, any other tree can be flattened with build(). The records and
+  strings can be saved in a compact binary form and loaded back, see
+  AstFile
+*/
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "node_kind.hpp"
+#include "output_sink.hpp"
+
+namespace mt {
+
+struct Node;
+
+struct FlatNode {
+  NodeKind kind;
+  uint8_t heading_level;
+  // The records of the node's subtree follow it, this one included
+  uint32_t subtree_size;
+  // The node's payload in the document's strings:
+  // Text, InlineCode: the text; Link: the url; Image: the url and alt text;
+  // CodeSpan: the language, followed by the slices of the code
+  uint32_t first_string;
+  uint32_t string_count;
+};
+
+class FlatDocument {
+public:
+  // Changes whenever the records or strings are saved differently
+  static constexpr uint32_t format_version = 1;
+
+  // The strings point into the tree's arena and source, which must outlive
+  // the flat document
+  void build(const Node &root);
+  void clear();
+
+  // Writes the records and strings, returning false when the sink fails or
+  // the strings add up to more than 4 GiB
+  bool save(OutputSink &output) const;
+  // Reads records and strings written by save(), the strings viewing the
+  // data, which must outlive the flat document. Returns false, leaving it
+  // empty, unless the data is a whole tree of this format version
+  bool load(std::string_view data);
+
+  // Appends the record of a node, returning its index. Its subtree is the
+  // record alone until closed, once the records of its children follow it
+  uint32_t append(const Node &node);
+  void close(uint32_t index);
+
+  size_t size() const {
+    return m_nodes.size();
+  }
+  const FlatNode &operator[](size_t index) const {
+    return m_nodes[index];
+  }
+  std::span<const std::string_view> strings(const FlatNode &node) const {
+    return {m_strings.data() + node.first_string, node.string_count};
+  }
+
+  // Index of the record following the first count children of the root
+  size_t children_end(size_t count) const;
+
+private:
+  std::vector<FlatNode> m_nodes;
+  std::vector<std::string_view> m_strings;
+  // Records of the nodes whose subtree is being flattened
+  std::vector<std::pair<uint32_t, const Node *>> m_open;
+};
+
+} // namespace mt
@@ -0,0 +1,61 @@
+/*
+  Flat Walker: base of renderers walking the records of a flat tree in
+  preorder. The deriving class gets every node entered and left through
+  static dispatch, instead of implementing every virtual call of Visitor
+  for the tree's nodes
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "flat_document.hpp"
+
+namespace mt {
+
+// The deriving class provides
+//   bool enter(const FlatDocument &document, const FlatNode &node);
+//   void leave(const FlatDocument &document, const FlatNode &node);
+// enter() renders the start of the node, returning false to stop the walk,
+// and leave() renders its end, once its subtree is rendered
+template <typename Derived> class FlatWalker {
+protected:
+  // Walks the records [begin, end), which have to be whole subtrees. Nodes
+  // still open when the walk stops are left all the same
+  void walk(const FlatDocument &document, size_t begin, size_t end) {
+    Derived &derived = static_cast<Derived &>(*this);
+    m_open_nodes.clear();
+
+    for (size_t index = begin; index < end; ++index) {
+      while (!m_open_nodes.empty()) {
+        const FlatNode &open = document[m_open_nodes.back()];
+        if (m_open_nodes.back() + open.subtree_size > index)
+          break;
+        derived.leave(document, open);
+        m_open_nodes.pop_back();
+      }
+
+      const FlatNode &node = document[index];
+      if (!derived.enter(document, node))
+        break;
+
+      // Nodes without children are left right away
+      if (node.subtree_size > 1)
+        m_open_nodes.push_back(static_cast<uint32_t>(index));
+      else
+        derived.leave(document, node);
+    }
+
+    while (!m_open_nodes.empty()) {
+      derived.leave(document, document[m_open_nodes.back()]);
+      m_open_nodes.pop_back();
+    }
+  }
+
+private:
+  // Records of the nodes entered and not left yet, kept between walks
+  std::vector<uint32_t> m_open_nodes;
+};
+
+} // namespace mt
@@ -4,42 +4,102 @@
 
 #pragma once
 
-#include "visitor.hpp"
-#include <sstream>
+#include "budget.hpp"
+#include "flat_document.hpp"
+#include "flat_walker.hpp"
+#include "node.hpp"
+#include "output_sink.hpp"
+#include "simd.hpp"
+#include <cstdint>
+#include <span>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace mt {
 
-class HtmlRenderer : public Visitor {
+class HtmlRenderer : public FlatWalker<HtmlRenderer> {
 public:
+  static constexpr size_t default_flush_size = 64 * 1024;
+
   explicit HtmlRenderer(std::string title, bool use_default_style = true,
                         bool only_body = false);
 
-  std::string get_output() const;
+  // Renders the whole HTML page, the returned view stays valid until the
+  // next render() or clear() call. With a sink, the page is handed to it
+  // instead and the view is empty
+  std::string_view render(const Document &document);
+  std::string_view render(const FlatDocument &document);
+  std::string_view get_output() const;
+
+  // Incremental rendering, each call appends to the output: the page's
+  // preamble, any number of top-level blocks and the page's ending
+  void begin_page();
+  void render_block(const Node &node);
+  // The first count top-level blocks of the document
+  void render_blocks(const Document &document, size_t count);
+  // The records [begin, end) of the document, which have to be whole
+  // subtrees
+  void render_nodes(const FlatDocument &document, size_t begin, size_t end);
+  void end_page();
+
+  // A top-level paragraph of escaped text rendered in parts, for input
+  // left unparsed past a limit: its start, any number of texts, its end
+  void begin_text_paragraph();
+  void render_text(std::string_view text);
+  void end_text_paragraph();
+
+  void set_title(std::string title);
   void clear();
 
-  void visit(const Document &node) override;
-  void visit(const Paragraph &node) override;
-  void visit(const Heading &node) override;
-  void visit(const CodeSpan &node) override;
-  void visit(const Text &node) override;
-  void visit(const Emphasis &node) override;
-  void visit(const StrongEmphasis &node) override;
-  void visit(const Link &node) override;
-  void visit(const Image &node) override;
-  void visit(const InlineCode &node) override;
-  void visit(const List &node) override;
-  void visit(const ListItem &node) override;
-  void visit(const BlockQuote &node) override;
+  // Hands the output to the sink (none when null) whenever it grows past
+  // flush_size bytes, right after the page's preamble and at its end
+  void set_sink(OutputSink *sink, size_t flush_size = default_flush_size);
+  // Hands the output rendered so far to the sink, returning false once
+  // the sink failed, after which nothing more gets rendered
+  bool flush();
+  // Bytes of the current page rendered so far, handed to the sink or not
+  size_t page_size() const;
+
+  // Enforces the budget's output limit: once a node would take the page
+  // past it, that node and all that follow are left out, the open tags
+  // still being closed
+  void set_budget(Budget *budget);
 
 private:
-  std::string escape_html(const std::string_view data);
+  friend class FlatWalker<HtmlRenderer>;
+
+  bool enter(const FlatDocument &document, const FlatNode &node);
+  void leave(const FlatDocument &document, const FlatNode &node);
+
+  const FlatDocument &flat_tree(const Document &document);
+  void open_tag(const FlatNode &node,
+                std::span<const std::string_view> strings);
+  void close_tag(const FlatNode &node);
+  bool within_output_limit(size_t node_begin);
+  void escape_html(const std::string_view data);
+  void escape_char(char c);
 
 private:
-  std::stringstream m_html_body;
+  std::string m_html;
   std::string m_title;
-  bool m_use_default_style;
-  bool m_only_body;
+  // Index of the page's layout for the options, see page_layouts
+  size_t m_layout;
+  simd::ClassifyFunction m_classify_escaped;
+
+  OutputSink *m_sink = nullptr;
+  size_t m_flush_size = default_flush_size;
+  bool m_sink_failed = false;
+
+  Budget *m_budget = nullptr;
+  size_t m_max_output_bytes = 0;
+  // Bytes of the page cleared from the output so far
+  size_t m_cleared_bytes = 0;
+  bool m_output_exhausted = false;
+  bool m_text_paragraph_open = false;
+
+  // Scratch space, kept between renders
+  FlatDocument m_flat;
 };
 
 } // namespace mt
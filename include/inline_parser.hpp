@@ -1,28 +1,69 @@
 /*
   Inline Parser: divides and groups tokens from a single line into Nodes, that
-  represent Markdown inline elements
+  represent Markdown inline elements. Every opener is paired with the first
+  fitting closer after it, which a single backward pass over the tokens
+  records up front, so parsing takes linear time
 */
 #pragma once
 
-#include <memory>
-#include <optional>
-#include <span>
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include "arena.hpp"
+#include "budget.hpp"
 #include "node.hpp"
 #include "token.hpp"
+#include "token_stream.hpp"
 
 namespace mt {
 class InlineParser {
 public:
-  static std::optional<size_t> find_next(std::span<const Token> tokens,
-                                         TokenType type, size_t start_index);
-  static std::string extract_text(std::span<const Token> tokens,
-                                  size_t index_start, size_t index_end);
-  static bool match(std::span<const Token> tokens, size_t index,
-                    TokenType type);
-
-  static std::vector<std::unique_ptr<Node>>
-  parse(std::span<const Token> tokens);
+  // Concatenated literals of the tokens, either viewing the source or
+  // copied into the arena
+  static std::string_view extract_text(TokenRange tokens, size_t index_start,
+                                       size_t index_end, Arena &arena);
+
+  // Appends the inline nodes of the tokens to the parent, the last node
+  // added to the document, allocating them in its arena
+  void parse(TokenRange tokens, Node &parent, Document &document);
+
+  // Enforces the budget's depth limit and deadline, see Budget
+  void set_budget(Budget *budget);
+
+private:
+  void find_closers();
+  void parse_range(size_t begin, size_t end, Node &parent);
+  void add_to_text(size_t index);
+  void add_text_node(Node &parent, size_t end);
+  bool match(size_t index, size_t end, TokenType type) const;
+  bool can_nest();
+  bool check_deadline();
+
+private:
+  TokenRange m_tokens;
+  Document *m_document = nullptr;
+
+  // For every opener, the index of the first closer after it: the next
+  // ']' for '[', the next ')' for '(' and the next run of the same length
+  // for runs of '`' and '*'. The range's size when there is none
+  std::vector<uint32_t> m_closers;
+  // Next run of every short length and of the longer ones during the pass
+  std::array<uint32_t, 4> m_next_star_runs{};
+  std::array<uint32_t, 8> m_next_backtick_runs{};
+  std::unordered_map<size_t, uint32_t> m_next_long_backtick_runs;
+
+  // First token of the text gathered for the next Text node
+  static constexpr size_t no_text = static_cast<size_t>(-1);
+  size_t m_text_begin = no_text;
+
+  Budget *m_budget = nullptr;
+  // Elements the current one is nested in
+  size_t m_depth = 0;
+  size_t m_tokens_until_check = 0;
+  // Set once the deadline passed, the remaining tokens being text
+  bool m_stopped = false;
 };
 } // namespace mt
@@ -0,0 +1,40 @@
+/*
+  Input File: read-only view of a whole input file, memory-mapped when
+  possible and read into a single buffer otherwise (pipes, special files)
+*/
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace mt {
+
+class InputFile {
+public:
+  InputFile() = default;
+  ~InputFile();
+
+  InputFile(const InputFile &) = delete;
+  InputFile &operator=(const InputFile &) = delete;
+  InputFile(InputFile &&other) noexcept;
+  InputFile &operator=(InputFile &&other) noexcept;
+
+  // Returns false when the file can't be opened or read
+  bool open(const std::string &path);
+  void close();
+
+  // Valid until the file is closed or reopened
+  std::string_view contents() const;
+  bool is_mapped() const;
+
+private:
+  bool read_whole(int descriptor, size_t size_hint);
+
+private:
+  const char *m_mapping = nullptr;
+  size_t m_mapping_size = 0;
+  std::string m_buffer;
+};
+
+} // namespace mt
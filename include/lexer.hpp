@@ -5,31 +5,44 @@
 
 #pragma once
 
-#include <optional>
+#include <cstdint>
 #include <string_view>
-#include <vector>
 
+#include "simd.hpp"
 #include "token.hpp"
+#include "token_stream.hpp"
 
 namespace mt {
 
 class Lexer {
 public:
-  explicit Lexer(std::string_view source);
+  explicit Lexer(std::string_view source = {});
 
-  std::vector<Token> tokenize();
+  void reset(std::string_view source);
+
+  // Tokenizes into the given stream, reusing its capacity. Sources larger
+  // than TokenStream::max_source_size leave the stream empty
+  void tokenize(TokenStream &tokens);
+  TokenStream tokenize();
 
 private:
-  void add_token(TokenType type, std::string_view literal, size_t line);
+  void add_token(TokenType type, size_t length);
+  void add_run_token(TokenType type, char character);
   bool at_eof() const;
-  std::optional<size_t> find_next_special() const;
+  // Index of the first special character at or after from, or the size of
+  // the source when there's none
+  size_t find_next_special(size_t from);
 
 private:
   std::string_view m_source;
-  std::vector<Token> m_tokens;
+  TokenStream *m_tokens;
 
   size_t m_index;
-  size_t m_line;
+
+  // Special character bitmask of the most recently classified block
+  size_t m_block_start;
+  uint64_t m_block_mask;
+  simd::ClassifyFunction m_classify;
 };
 
 } // namespace mt
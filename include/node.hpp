@@ -3,31 +3,115 @@
 */
 #pragma once
 
-#include <memory>
-#include <string>
-#include <vector>
+#include <span>
+#include <string_view>
+#include <utility>
 
+#include "arena.hpp"
+#include "flat_document.hpp"
+#include "node_kind.hpp"
 #include "token.hpp"
+#include "token_stream.hpp"
 #include "visitor.hpp"
 
 namespace mt {
 
+// Nodes live in the arena of their Document, linked to their first child
+// and next sibling, and are never destroyed one by one
 struct Node {
-  virtual ~Node() = default;
+  explicit Node(NodeKind node_kind)
+      : kind(node_kind) {
+  }
 
   virtual void accept(Visitor &visitor) const = 0;
 
-  std::vector<std::unique_ptr<Node>> children;
+  class ChildIterator {
+  public:
+    explicit ChildIterator(const Node *node)
+        : m_node(node) {
+    }
+
+    const Node &operator*() const {
+      return *m_node;
+    }
+    ChildIterator &operator++() {
+      m_node = m_node->next_sibling;
+      return *this;
+    }
+    bool operator==(const ChildIterator &other) const = default;
+
+  private:
+    const Node *m_node;
+  };
+
+  struct ChildRange {
+    const Node *first;
+
+    ChildIterator begin() const {
+      return ChildIterator(first);
+    }
+    ChildIterator end() const {
+      return ChildIterator(nullptr);
+    }
+  };
+
+  ChildRange children() const {
+    return {first_child};
+  }
+
+  void append_child(Node *child) {
+    if (last_child)
+      last_child->next_sibling = child;
+    else
+      first_child = child;
+    last_child = child;
+  }
+
+  Node *first_child = nullptr;
+  Node *last_child = nullptr;
+  Node *next_sibling = nullptr;
+  NodeKind kind;
 };
 
-struct Document : Node {
+// Owns the arena every other node of the tree lives in
+struct Document final : Node {
+  Document()
+      : Node(NodeKind::DOCUMENT) {
+  }
+
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
   }
+
+  // Releases the whole tree, keeping the memory for the next one
+  void clear() {
+    arena.reset();
+    flat.clear();
+    first_child = nullptr;
+    last_child = nullptr;
+  }
+
+  // Creates a node in the arena and appends its record to the flat tree,
+  // so nodes have to be added in preorder
+  template <typename T, typename... Args>
+  T *add(Node &parent, Args &&...args) {
+    T *node = arena.create<T>(std::forward<Args>(args)...);
+    parent.append_child(node);
+    flat.append(*node);
+    return node;
+  }
+
+  Arena arena;
+  // The same tree, as parsed
+  FlatDocument flat;
 };
 
 struct Paragraph : Node {
-  std::vector<Token> tokens;
+  Paragraph()
+      : Node(NodeKind::PARAGRAPH) {
+  }
+
+  TokenRange tokens;
 
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
@@ -36,11 +120,12 @@ struct Paragraph : Node {
 
 struct Heading : Node {
   explicit Heading(uint8_t level)
-      : heading_level(level) {
+      : Node(NodeKind::HEADING),
+        heading_level(level) {
   }
 
   uint8_t heading_level;
-  std::vector<Token> tokens;
+  TokenRange tokens;
 
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
@@ -48,12 +133,15 @@ struct Heading : Node {
 };
 
 struct CodeSpan : Node {
-  explicit CodeSpan(std::string lang)
-      : language(std::move(lang)) {
+  explicit CodeSpan(std::string_view lang)
+      : Node(NodeKind::CODE_SPAN),
+        language(lang) {
   }
 
-  std::string language;
-  std::vector<Token> tokens;
+  std::string_view language;
+  // Slices of the source making up the code, once joined. Lines inside
+  // containers are sliced apart to leave out the container markers
+  std::span<const std::string_view> code;
 
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
@@ -61,11 +149,12 @@ struct CodeSpan : Node {
 };
 
 struct Text : Node {
-  explicit Text(std::string text)
-      : text(std::move(text)) {
+  explicit Text(std::string_view text)
+      : Node(NodeKind::TEXT),
+        text(text) {
   }
 
-  std::string text;
+  std::string_view text;
 
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
@@ -73,23 +162,32 @@ struct Text : Node {
 };
 
 struct Emphasis : Node {
+  Emphasis()
+      : Node(NodeKind::EMPHASIS) {
+  }
+
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
   }
 };
 
 struct StrongEmphasis : Node {
+  StrongEmphasis()
+      : Node(NodeKind::STRONG_EMPHASIS) {
+  }
+
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
   }
 };
 
 struct Link : Node {
-  explicit Link(std::string url)
-      : url(std::move(url)) {
+  explicit Link(std::string_view url)
+      : Node(NodeKind::LINK),
+        url(url) {
   }
 
-  std::string url;
+  std::string_view url;
 
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
@@ -97,13 +195,14 @@ struct Link : Node {
 };
 
 struct Image : Node {
-  Image(std::string url, std::string alt)
-      : url(std::move(url)),
-        alt_text(std::move(alt)) {
+  Image(std::string_view url, std::string_view alt)
+      : Node(NodeKind::IMAGE),
+        url(url),
+        alt_text(alt) {
   }
 
-  std::string url;
-  std::string alt_text;
+  std::string_view url;
+  std::string_view alt_text;
 
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
@@ -111,10 +210,11 @@ struct Image : Node {
 };
 
 struct InlineCode : Node {
-  explicit InlineCode(std::string code_text)
-      : code(std::move(code_text)) {
+  explicit InlineCode(std::string_view code_text)
+      : Node(NodeKind::INLINE_CODE),
+        code(code_text) {
   }
-  std::string code;
+  std::string_view code;
 
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
@@ -122,18 +222,30 @@ struct InlineCode : Node {
 };
 
 struct List : Node {
+  List()
+      : Node(NodeKind::LIST) {
+  }
+
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
   }
 };
 
 struct ListItem : Node {
+  ListItem()
+      : Node(NodeKind::LIST_ITEM) {
+  }
+
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
   }
 };
 
 struct BlockQuote : Node {
+  BlockQuote()
+      : Node(NodeKind::BLOCK_QUOTE) {
+  }
+
   void accept(Visitor &visitor) const override {
     visitor.visit(*this);
   }
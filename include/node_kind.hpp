@@ -0,0 +1,30 @@
+/*
+  Node Kind: tags every kind of AST node
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mt {
+
+enum class NodeKind : uint8_t {
+  DOCUMENT = 0,
+  PARAGRAPH,
+  HEADING,
+  CODE_SPAN,
+  TEXT,
+  EMPHASIS,
+  STRONG_EMPHASIS,
+  LINK,
+  IMAGE,
+  INLINE_CODE,
+  LIST,
+  LIST_ITEM,
+  BLOCK_QUOTE
+};
+
+inline constexpr size_t node_kind_count =
+    static_cast<size_t>(NodeKind::BLOCK_QUOTE) + 1;
+
+} // namespace mt
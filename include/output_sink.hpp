@@ -0,0 +1,77 @@
+/*
+  Output Sink: destination the renderer hands its output to part by part,
+  so that a whole page never has to be held in memory at once
+*/
+#pragma once
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace mt {
+
+class OutputSink {
+public:
+  virtual ~OutputSink() = default;
+
+  // Takes the next part of the output, returning false once it can't be
+  // written anymore
+  virtual bool write(std::string_view data) = 0;
+};
+
+// Growable contiguous buffer, holding the whole output
+class BufferSink final : public OutputSink {
+public:
+  bool write(std::string_view data) override;
+
+  std::string_view view() const;
+  // Keeps the buffer's capacity
+  void clear();
+
+private:
+  std::string m_buffer;
+};
+
+// File written to directly, without buffering of its own
+class FileSink final : public OutputSink {
+public:
+  FileSink() = default;
+  // Writes to an already open descriptor (POSIX), which isn't closed
+  explicit FileSink(int descriptor);
+  ~FileSink() override;
+
+  FileSink(const FileSink &) = delete;
+  FileSink &operator=(const FileSink &) = delete;
+
+  // Creates or truncates the file, returning false when it can't
+  bool open(const std::string &path);
+  void close();
+
+  bool write(std::string_view data) override;
+
+  // Bytes written since the file was opened
+  size_t written_bytes() const;
+
+private:
+  int m_descriptor = -1;
+  bool m_owned = false;
+  size_t m_written_bytes = 0;
+  // Files on systems without POSIX descriptors
+  std::FILE *m_file = nullptr;
+};
+
+// Hands every part to a function, which returns false to stop the output
+class CallbackSink final : public OutputSink {
+public:
+  using Callback = std::function<bool(std::string_view)>;
+
+  explicit CallbackSink(Callback callback);
+
+  bool write(std::string_view data) override;
+
+private:
+  Callback m_callback;
+};
+
+} // namespace mt
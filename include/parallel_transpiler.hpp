@@ -0,0 +1,92 @@
+/*
+  Parallel Transpiler: transpiles a document held in memory on several
+  threads. The document is split before top-level blocks which can't be
+  affected by what precedes them (see SplitScanner), the parts are lexed,
+  parsed and rendered independently and their HTML is written in order,
+  the same as TranspileContext renders it
+*/
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "budget.hpp"
+#include "html_renderer.hpp"
+#include "lexer.hpp"
+#include "node.hpp"
+#include "output_sink.hpp"
+#include "stats.hpp"
+#include "token_stream.hpp"
+#include "transpile_context.hpp"
+
+namespace mt {
+
+class ParallelTranspiler {
+public:
+  // Smallest part given to a thread, smaller documents are transpiled on
+  // the calling thread
+  static constexpr size_t min_part_size = 256 * 1024;
+
+  // A thread count of 0 picks one thread per core. With limits set, the
+  // document is transpiled on the calling thread, as they apply to it as
+  // a whole
+  explicit ParallelTranspiler(RenderOptions options, size_t thread_count = 0);
+
+  // Returns false when the sink fails
+  bool transpile(std::string_view markdown, OutputSink &output);
+
+  // When set, every following transpile() adds its figures into the stats.
+  // The stage times of the threads add up, so they can exceed the wall
+  // clock time
+  void set_stats(TranspileStats *stats);
+
+  // Whether the last transpile() hit one of the limits, and which
+  Status status() const;
+
+  size_t thread_count() const;
+
+private:
+  struct Part {
+    std::string_view source;
+    std::string html;
+    bool rendered = false;
+  };
+
+  // Buffers of one thread, kept between calls
+  struct Worker {
+    Lexer lexer;
+    TokenStream tokens;
+    Document document;
+    HtmlRenderer renderer{""};
+    TranspileStats stats;
+  };
+
+  void work(Worker &worker);
+  void transpile_part(Worker &worker, Part &part);
+  bool write_parts(OutputSink &output);
+
+private:
+  TranspileContext m_context;
+  HtmlRenderer m_renderer;
+  bool m_serial;
+  size_t m_thread_count;
+  TranspileStats *m_stats;
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::vector<Part> m_parts;
+
+  // Guards the progress below, shared by the workers and the writer
+  std::mutex m_mutex;
+  std::condition_variable m_part_rendered;
+  std::condition_variable m_part_written;
+  size_t m_next_part = 0;
+  size_t m_written_parts = 0;
+  bool m_stopping = false;
+};
+
+} // namespace mt
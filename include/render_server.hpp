@@ -0,0 +1,126 @@
+/*
+  Render Server: transpiles requests framed on a stream, read from
+  standard input or from the connections of a Unix domain socket, so that
+  a service starts the process only once. A request is an options byte
+  and the length of its Markdown as 4 big-endian bytes, followed by the
+  Markdown. Its response is a status byte and the length of its HTML the
+  same way, followed by the HTML. The serving thread reads the requests
+  of all open connections as they arrive, and only whole requests are
+  handed to a fixed pool of workers, each keeping its lexer, parser and
+  renderer buffers. Idle connections so take up no worker
+*/
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "budget.hpp"
+#include "output_sink.hpp"
+#include "transpile_context.hpp"
+
+namespace mt {
+
+class RenderServer {
+public:
+  // Bits of the options byte of a request
+  static constexpr uint8_t only_body_option = 1;
+  static constexpr uint8_t no_styling_option = 2;
+  // Status of the response to a malformed request, after which the
+  // connection is closed, or to one whose HTML is over 4 GiB. The others
+  // are the values of Status
+  static constexpr uint8_t request_error = 0xff;
+
+  static constexpr size_t default_max_request_size = 64 * 1024 * 1024;
+
+  // A worker count of 0 picks one per core. The limits apply to every
+  // request, and requests with more Markdown are refused
+  explicit RenderServer(Limits limits = {}, size_t worker_count = 0,
+                        size_t max_request_size = default_max_request_size);
+  ~RenderServer();
+
+  RenderServer(const RenderServer &) = delete;
+  RenderServer &operator=(const RenderServer &) = delete;
+
+  // Serves the requests of a stream in order, on the calling thread, until
+  // it ends. Returns false when it can't be read or written, or a request
+  // is malformed
+  bool serve_stream(int input = 0, int output = 1);
+
+  // Listens on the socket, replacing one left behind by a server which is
+  // gone, and serves its connections until stopped. Returns false when it
+  // can't listen or accept connections
+  bool serve_socket(const std::string &path);
+  // Stops accepting connections for good, from another thread. The
+  // connections accepted by then are still served until they end
+  void stop();
+
+  size_t worker_count() const;
+
+private:
+  // Buffers of one worker, with a context for every set of options
+  struct Worker {
+    std::array<std::unique_ptr<TranspileContext>, 4> contexts;
+    std::string request;
+  };
+
+  // A socket connection and the bytes read from it but not yet answered.
+  // Either the serving thread reads it, or, once it holds a whole request,
+  // a worker answers it
+  struct Connection {
+    int descriptor = -1;
+    std::string input;
+    bool busy = false;
+    bool failed = false;
+  };
+
+  bool serve_connection(Worker &worker, int input, int output);
+  bool check_request(const unsigned char *header, FileSink &response);
+  bool respond(Worker &worker, uint8_t options, std::string_view markdown,
+               FileSink &response);
+  TranspileContext &context(Worker &worker, uint8_t options);
+
+  // Serving thread
+  bool serve_connections(int listener);
+  bool read_connection(Connection &connection);
+  void queue_request(Connection &connection);
+  void wake();
+
+  void work(Worker &worker);
+  void report_error(std::string_view message);
+
+private:
+  Limits m_limits;
+  size_t m_worker_count;
+  size_t m_max_request_size;
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::atomic<bool> m_stopping;
+  std::atomic<int> m_listener;
+  // Pipe waking the serving thread up, its reading and writing ends
+  int m_wake_input;
+  std::atomic<int> m_wake_output;
+
+  // Open connections, only touched by the serving thread
+  std::vector<std::unique_ptr<Connection>> m_connections;
+
+  // Guards the requests waiting for a worker and the connections answered
+  // since, to be read again by the serving thread
+  std::mutex m_mutex;
+  std::condition_variable m_request_added;
+  std::deque<Connection *> m_requests;
+  std::vector<Connection *> m_answered;
+  bool m_requests_done = false;
+  // Keeps the errors of the workers on lines of their own
+  std::mutex m_error_mutex;
+};
+
+} // namespace mt
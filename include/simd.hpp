@@ -0,0 +1,27 @@
+/*
+  SIMD: vectorized byte classification kernels, the best variant supported by
+  the running CPU is picked once at runtime
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace mt::simd {
+
+inline constexpr size_t block_size = 64;
+
+// Bit i of the result is set when block[i] is one of the characters ending
+// a TEXT token (see Lexer), the block must be block_size bytes long
+using ClassifyFunction = uint64_t (*)(const char *block);
+
+ClassifyFunction special_char_classifier();
+// Same for the characters HtmlRenderer escapes: & " ' < > and \r, null
+// when no vector instructions are available
+ClassifyFunction escaped_char_classifier();
+
+// "avx2", "sse2" or "scalar"
+std::string_view active_instruction_set();
+
+} // namespace mt::simd
@@ -0,0 +1,86 @@
+/*
+  Stats: per-stage timings, allocation totals and token/node counts of a
+  single transpilation, reported by the --stats option
+*/
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "allocation_counter.hpp"
+#include "node.hpp"
+#include "output_sink.hpp"
+#include "token.hpp"
+#include "token_stream.hpp"
+
+namespace mt {
+
+struct StageStats {
+  std::string_view name;
+  double seconds = 0.0;
+  size_t allocations = 0;
+  size_t allocated_bytes = 0;
+};
+
+struct TranspileStats {
+  StageStats read{"read"};
+  StageStats lex{"lex"};
+  StageStats parse{"parse"};
+  StageStats render{"render"};
+  StageStats write{"write"};
+
+  std::array<size_t, token_type_count> token_counts{};
+  std::array<size_t, node_kind_count> node_counts{};
+  size_t input_bytes = 0;
+  size_t output_bytes = 0;
+
+  // Adds up the figures of another transpilation
+  void add(const TranspileStats &other);
+
+  void count_tokens(const TokenStream &tokens);
+  // Only the tokens at indices [begin, end)
+  void count_tokens(const TokenStream &tokens, size_t begin, size_t end);
+  // The node and all of its descendants
+  void count_nodes(const Node &node);
+
+  std::string to_text() const;
+  std::string to_json() const;
+};
+
+// Measures the lifetime of the scope into the given stage, less what the
+// nested stage (when given) gains meanwhile, so that the two don't overlap
+class StageTimer {
+public:
+  explicit StageTimer(StageStats *stage, const StageStats *nested = nullptr);
+  ~StageTimer();
+
+  StageTimer(const StageTimer &) = delete;
+  StageTimer &operator=(const StageTimer &) = delete;
+
+private:
+  StageStats *m_stage;
+  std::chrono::steady_clock::time_point m_start;
+  allocation_counter::Snapshot m_allocations;
+  const StageStats *m_nested;
+  StageStats m_nested_start;
+};
+
+// Hands every part to another sink, measuring the writes into the stage
+class TimedSink final : public OutputSink {
+public:
+  TimedSink(OutputSink &sink, StageStats *stage);
+
+  bool write(std::string_view data) override;
+
+private:
+  OutputSink &m_sink;
+  StageStats *m_stage;
+};
+
+std::string_view token_type_name(TokenType type);
+std::string_view node_kind_name(NodeKind kind);
+
+} // namespace mt
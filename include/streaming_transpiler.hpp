@@ -0,0 +1,78 @@
+/*
+  Streaming Transpiler: transpiles input read in chunks, rendering and
+  releasing top-level blocks as soon as they're closed, so the memory use
+  follows the largest block instead of the whole document
+*/
+#pragma once
+
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "budget.hpp"
+#include "html_renderer.hpp"
+#include "lexer.hpp"
+#include "node.hpp"
+#include "output_sink.hpp"
+#include "stats.hpp"
+#include "token_stream.hpp"
+#include "transpile_context.hpp"
+
+namespace mt {
+
+class StreamingTranspiler {
+public:
+  static constexpr size_t default_chunk_size = 1024 * 1024;
+
+  explicit StreamingTranspiler(
+      RenderOptions options, size_t chunk_size = default_chunk_size,
+      size_t flush_size = HtmlRenderer::default_flush_size);
+
+  // Produces the same HTML as TranspileContext::render() over the whole
+  // input. Returns false when reading or writing fails
+  bool transpile(std::istream &input, std::ostream &output);
+  // Hands the output to the sink whenever flush_size bytes are rendered,
+  // and once every read chunk is rendered
+  bool transpile(std::istream &input, OutputSink &output);
+
+  // When set, every following transpile() adds its figures into the stats
+  void set_stats(TranspileStats *stats);
+
+  // The most input bytes held at once during the last transpile()
+  size_t peak_pending_bytes() const;
+
+  // Whether the last transpile() hit one of the limits, and which
+  Status status() const;
+
+private:
+  bool transpile_chunks(std::istream &input);
+  bool read_chunk(std::istream &input);
+  size_t render_closed_blocks(std::string_view source, bool is_last);
+  size_t render_remaining_text(std::string_view source, bool is_last);
+  bool flush();
+
+private:
+  Lexer m_lexer;
+  TokenStream m_tokens;
+  Document m_document;
+  HtmlRenderer m_renderer;
+  Budget m_budget;
+  Budget *m_active_budget;
+  TranspileStats *m_stats;
+
+  size_t m_chunk_size;
+  size_t m_flush_size;
+  // Input read, but not yet part of a rendered block
+  std::string m_pending;
+  size_t m_peak_pending_bytes;
+
+  // Past the token limit or the deadline the rest of the input is no
+  // longer parsed, only escaped into one trailing paragraph, opened at its
+  // first non-blank character
+  bool m_stopped;
+  bool m_text_started;
+};
+
+} // namespace mt
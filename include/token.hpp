@@ -3,10 +3,12 @@
 */
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string_view>
 
 namespace mt {
-enum class TokenType {
+enum class TokenType : uint8_t {
   START_OF_FILE = 0,
   END_OF_FILE,
   NEW_LINE,
@@ -26,10 +28,19 @@ enum class TokenType {
   SQR_BRACKET_CLOSE
 };
 
+inline constexpr size_t token_type_count =
+    static_cast<size_t>(TokenType::SQR_BRACKET_CLOSE) + 1;
+
+// SPACE, TAB, HASH, BACKTICK, STAR and HYPHEN tokens cover a whole run of
+// their character, so their literal's length is the repeat count.
+// Tokens are stored in a TokenStream, this is just a view of one of them
 struct Token {
   TokenType type;
   std::string_view literal;
-  size_t line_at;
+
+  size_t count() const {
+    return literal.size();
+  }
 };
 
 } // namespace mt
@@ -0,0 +1,140 @@
+/*
+  Token Stream: compact structure-of-arrays storage of the tokens of a single
+  source, literals and line numbers are derived from the source on demand
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+#include "token.hpp"
+
+namespace mt {
+
+class TokenStream {
+public:
+  // Offsets and lengths are 32 bit
+  static constexpr size_t max_source_size =
+      std::numeric_limits<uint32_t>::max();
+
+  TokenStream() = default;
+  explicit TokenStream(std::string_view source);
+
+  // Empties the stream for a new source, keeping the arrays' capacity
+  void reset(std::string_view source);
+  void reserve(size_t token_count);
+
+  void push(TokenType type, size_t offset, size_t length) {
+    m_types.push_back(static_cast<uint8_t>(type));
+    m_offsets.push_back(static_cast<uint32_t>(offset));
+    m_lengths.push_back(static_cast<uint32_t>(length));
+  }
+
+  size_t size() const {
+    return m_types.size();
+  }
+
+  bool empty() const {
+    return m_types.empty();
+  }
+
+  TokenType type(size_t index) const {
+    return static_cast<TokenType>(m_types[index]);
+  }
+
+  size_t offset(size_t index) const {
+    return m_offsets[index];
+  }
+
+  size_t length(size_t index) const {
+    return m_lengths[index];
+  }
+
+  std::string_view literal(size_t index) const {
+    return m_source.substr(m_offsets[index], m_lengths[index]);
+  }
+
+  Token operator[](size_t index) const {
+    return Token{type(index), literal(index)};
+  }
+
+  Token back() const {
+    return (*this)[size() - 1];
+  }
+
+  // Counted from 1. The offsets of the source's newlines are only found on
+  // the first call, keeping the lexer from paying for them on every run, so
+  // a stream shouldn't be asked from several threads at once
+  size_t line_at(size_t index) const;
+
+  std::string_view source() const {
+    return m_source;
+  }
+
+private:
+  std::string_view m_source;
+  std::vector<uint8_t> m_types;
+  std::vector<uint32_t> m_offsets;
+  std::vector<uint32_t> m_lengths;
+  // Built by line_at()
+  mutable std::vector<uint32_t> m_new_lines;
+  mutable bool m_new_lines_found = false;
+};
+
+// Tokens [begin, end) of a TokenStream, which has to outlive it. Blocks whose
+// lines are split by container markers pick their tokens through an index
+// array instead, in which case begin and end are positions in that array
+struct TokenRange {
+  const TokenStream *stream = nullptr;
+  const uint32_t *indices = nullptr;
+  uint32_t begin = 0;
+  uint32_t end = 0;
+
+  TokenRange() = default;
+  TokenRange(const TokenStream &tokens, size_t begin_index, size_t end_index)
+      : stream(&tokens),
+        begin(static_cast<uint32_t>(begin_index)),
+        end(static_cast<uint32_t>(end_index)) {
+  }
+  TokenRange(const TokenStream &tokens, const uint32_t *token_indices,
+             size_t begin_index, size_t end_index)
+      : stream(&tokens),
+        indices(token_indices),
+        begin(static_cast<uint32_t>(begin_index)),
+        end(static_cast<uint32_t>(end_index)) {
+  }
+
+  size_t size() const {
+    return end - begin;
+  }
+
+  bool empty() const {
+    return begin == end;
+  }
+
+  // Index in the TokenStream of the token at the given index
+  size_t stream_index(size_t index) const {
+    return indices ? indices[begin + index] : begin + index;
+  }
+
+  TokenType type(size_t index) const {
+    return stream->type(stream_index(index));
+  }
+
+  std::string_view literal(size_t index) const {
+    return stream->literal(stream_index(index));
+  }
+
+  Token operator[](size_t index) const {
+    return (*stream)[stream_index(index)];
+  }
+
+  TokenRange subrange(size_t offset, size_t count) const {
+    return TokenRange(*stream, indices, begin + offset, begin + offset + count);
+  }
+};
+
+} // namespace mt
@@ -0,0 +1,65 @@
+/*
+  Transpile Context: in-memory entry point for embedding the transpiler,
+  keeps the lexer, parser and renderer buffers alive between calls
+*/
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "budget.hpp"
+#include "html_renderer.hpp"
+#include "lexer.hpp"
+#include "node.hpp"
+#include "output_sink.hpp"
+#include "stats.hpp"
+#include "token_stream.hpp"
+
+namespace mt {
+
+struct RenderOptions {
+  std::string title;
+  bool use_default_style = true;
+  bool only_body = false;
+  // Bounds the work spent on untrusted input, see Budget
+  Limits limits = {};
+};
+
+class TranspileContext {
+public:
+  explicit TranspileContext(RenderOptions options = {});
+
+  // Transpiles the given Markdown into HTML, the returned view stays valid
+  // until the next render() call on this context
+  std::string_view render(std::string_view markdown);
+  // Transpiles straight into the sink, a part at a time, returning false
+  // when the sink fails
+  bool render(std::string_view markdown, OutputSink &sink,
+              size_t flush_size = HtmlRenderer::default_flush_size);
+
+  void set_title(std::string title);
+
+  // When set, every following render() adds its lex, parse and render
+  // figures into the given stats
+  void set_stats(TranspileStats *stats);
+
+  const Document *document() const;
+
+  // Whether the last render() hit one of the limits, and which
+  Status status() const;
+
+private:
+  std::string_view transpile(std::string_view markdown);
+
+private:
+  Lexer m_lexer;
+  TokenStream m_tokens;
+  Document m_document;
+  HtmlRenderer m_renderer;
+  Budget m_budget;
+  // The budget, when any limit is set
+  Budget *m_active_budget;
+  TranspileStats *m_stats;
+};
+
+} // namespace mt
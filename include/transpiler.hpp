@@ -3,16 +3,80 @@
 */
 #pragma once
 
+#include <filesystem>
 #include <string>
+#include <vector>
+
+#include "batch_transpiler.hpp"
+#include "budget.hpp"
+#include "build_cache.hpp"
+#include "parallel_transpiler.hpp"
+#include "stats.hpp"
+#include "transpile_context.hpp"
 
 namespace mt {
+
+enum class StatsFormat { NONE, TEXT, JSON };
+
+struct TranspilerOptions {
+  bool use_default_styling = true;
+  bool only_body = false;
+  // Bounded memory mode, see StreamingTranspiler
+  bool stream = false;
+  // Threads transpiling the whole file, 0 for one per core, see
+  // ParallelTranspiler
+  size_t threads = 1;
+  // Transpiles a directory tree on N jobs, see BatchTranspiler
+  bool batch = false;
+  size_t jobs = 0;
+  // Directory of the build cache, none when empty, see BuildCache
+  std::string cache_directory;
+  // Stays running, transpiling the input again whenever it changes, once
+  // its writes have stopped for the debounce time, see FileWatcher
+  bool watch = false;
+  size_t debounce_ms = 100;
+  // Serves framed requests from standard input, or from the Unix socket
+  // when given, on N jobs, see RenderServer
+  bool serve = false;
+  std::string serve_socket;
+  StatsFormat stats_format = StatsFormat::NONE;
+  Limits limits;
+};
+
 class Transpiler {
 public:
   static int run(int argc, char *argv[]);
 
 private:
+  static bool parse_number(const std::string &arg, size_t &number);
+  static RenderOptions render_options(const std::string &input_path,
+                                      const TranspilerOptions &options);
   static bool transpile(const std::string &input_path,
                         const std::string &output_path,
-                        bool use_default_styling, bool only_body);
+                        const TranspilerOptions &options,
+                        ParallelTranspiler &transpiler,
+                        const BuildCache *cache, Status &status);
+  static int serve(const TranspilerOptions &options);
+  static int watch(const std::string &input_path,
+                   const std::string &output_path,
+                   const TranspilerOptions &options);
+  static int transpile_batch(const std::string &input_directory,
+                             const std::string &output_directory,
+                             const TranspilerOptions &options);
+  static int report_batch(const BatchTranspiler &transpiler,
+                          const std::string &input_directory,
+                          const std::string &output_directory,
+                          const TranspilerOptions &options,
+                          const TranspileStats &stats);
+  static bool transpile_whole(const std::string &input_path,
+                              const std::string &output_path,
+                              const TranspilerOptions &options,
+                              ParallelTranspiler &transpiler,
+                              const BuildCache *cache, TranspileStats *stats,
+                              Status &status, bool &cached);
+  static bool transpile_streaming(const std::string &input_path,
+                                  const std::string &output_path,
+                                  const TranspilerOptions &options,
+                                  TranspileStats *stats, Status &status);
 };
 } // namespace mt
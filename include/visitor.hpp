@@ -2,6 +2,7 @@
 
 namespace mt {
 
+struct Node;
 struct Document;
 struct Paragraph;
 struct Heading;
@@ -0,0 +1,116 @@
+/*
+  Replaces the global allocation functions to feed the allocation counter,
+  only linked into the binaries that report allocation totals
+*/
+#include <cstdlib>
+#include <new>
+
+#include "allocation_counter.hpp"
+
+namespace {
+
+const bool hooks_enabled = (mt::allocation_counter::enable(), true);
+
+void *allocate(std::size_t size) {
+  mt::allocation_counter::record(size);
+  if (void *pointer = std::malloc(size == 0 ? 1 : size))
+    return pointer;
+  throw std::bad_alloc();
+}
+
+void *allocate_aligned(std::size_t size, std::align_val_t alignment) {
+  mt::allocation_counter::record(size);
+  std::size_t align = static_cast<std::size_t>(alignment);
+  // aligned_alloc requires the size to be a multiple of the alignment
+  std::size_t padded = (size + align - 1) / align * align;
+#if defined(_MSC_VER)
+  void *pointer = _aligned_malloc(padded == 0 ? align : padded, align);
+#else
+  void *pointer = std::aligned_alloc(align, padded == 0 ? align : padded);
+#endif
+  if (pointer)
+    return pointer;
+  throw std::bad_alloc();
+}
+
+void release_aligned(void *pointer) {
+#if defined(_MSC_VER)
+  _aligned_free(pointer);
+#else
+  std::free(pointer);
+#endif
+}
+
+} // namespace
+
+void *operator new(std::size_t size) {
+  return allocate(size);
+}
+
+void *operator new[](std::size_t size) {
+  return allocate(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  return allocate_aligned(size, alignment);
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return allocate_aligned(size, alignment);
+}
+
+void operator delete(void *pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept {
+  release_aligned(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept {
+  release_aligned(pointer);
+}
+
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept {
+  release_aligned(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t, std::align_val_t) noexcept {
+  release_aligned(pointer);
+}
@@ -0,0 +1,82 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace mt {
+
+namespace {
+
+// Blocks stop growing past this size, so a large document doesn't leave
+// a mostly unused block behind
+constexpr size_t max_block_size = 1024 * 1024;
+
+std::byte *align_up(std::byte *pointer, size_t alignment) {
+  auto address = reinterpret_cast<uintptr_t>(pointer);
+  auto aligned = (address + alignment - 1) & ~(uintptr_t(alignment) - 1);
+  return pointer + (aligned - address);
+}
+
+} // namespace
+
+Arena::Arena(size_t initial_block_size)
+    : m_blocks(),
+      m_next_block_size(std::max<size_t>(initial_block_size, 64)) {
+}
+
+void *Arena::allocate(size_t size, size_t alignment) {
+  std::byte *aligned = align_up(m_position, alignment);
+  if (m_position && static_cast<size_t>(m_block_end - aligned) >= size) {
+    m_position = aligned + size;
+    return aligned;
+  }
+
+  return allocate_from_next_block(size, alignment);
+}
+
+// Moves on to the next block kept from before a reset, or to a new one,
+// large enough to hold the allocation
+void *Arena::allocate_from_next_block(size_t size, size_t alignment) {
+  size_t needed = size + alignment;
+
+  size_t next = m_position ? m_block + 1 : 0;
+  while (next < m_blocks.size() && m_blocks[next].size < needed)
+    next++;
+
+  if (next == m_blocks.size()) {
+    size_t block_size = std::max(m_next_block_size, needed);
+    m_blocks.push_back(
+        {std::make_unique_for_overwrite<std::byte[]>(block_size), block_size});
+    m_next_block_size = std::min(m_next_block_size * 2, max_block_size);
+  }
+
+  m_block = next;
+  Block &block = m_blocks[m_block];
+  std::byte *aligned = align_up(block.data.get(), alignment);
+  m_position = aligned + size;
+  m_block_end = block.data.get() + block.size;
+  return aligned;
+}
+
+std::string_view Arena::copy(std::string_view text) {
+  if (text.empty())
+    return {};
+  auto *copied = static_cast<char *>(allocate(text.size(), 1));
+  std::memcpy(copied, text.data(), text.size());
+  return {copied, text.size()};
+}
+
+void Arena::reset() {
+  m_block = 0;
+  m_position = nullptr;
+  m_block_end = nullptr;
+}
+
+size_t Arena::capacity() const {
+  size_t bytes = 0;
+  for (const Block &block : m_blocks)
+    bytes += block.size;
+  return bytes;
+}
+
+} // namespace mt
@@ -0,0 +1,36 @@
+#include "ast_file.hpp"
+
+#include "output_sink.hpp"
+
+namespace mt {
+
+bool AstFile::save(const FlatDocument &document, const std::string &path) {
+  FileSink file;
+  if (!file.open(path))
+    return false;
+  bool written = document.save(file);
+  file.close();
+  return written;
+}
+
+bool AstFile::open(const std::string &path) {
+  close();
+  if (!m_file.open(path))
+    return false;
+  if (!m_document.load(m_file.contents())) {
+    m_file.close();
+    return false;
+  }
+  return true;
+}
+
+void AstFile::close() {
+  m_document.clear();
+  m_file.close();
+}
+
+const FlatDocument &AstFile::document() const {
+  return m_document;
+}
+
+} // namespace mt
@@ -0,0 +1,295 @@
+#include "batch_transpiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include "input_file.hpp"
+#include "output_sink.hpp"
+#include "token_stream.hpp"
+
+namespace mt {
+
+namespace fs = std::filesystem;
+
+void BatchSummary::add(const BatchSummary &other) {
+  file_count += other.file_count;
+  failed_count += other.failed_count;
+  limited_count += other.limited_count;
+  cached_count += other.cached_count;
+  input_bytes += other.input_bytes;
+  output_bytes += other.output_bytes;
+}
+
+BatchTranspiler::Worker::Worker(const RenderOptions &options)
+    : context(options),
+      stats(),
+      summary() {
+}
+
+BatchTranspiler::BatchTranspiler(RenderOptions options, size_t job_count)
+    : m_options(std::move(options)),
+      m_job_count(job_count ? job_count
+                            : std::max(std::thread::hardware_concurrency(),
+                                       1u)),
+      m_stats(nullptr),
+      m_cache(nullptr),
+      m_summary(),
+      m_workers(),
+      m_queues() {
+}
+
+bool BatchTranspiler::transpile(const std::string &input_directory,
+                                const std::string &output_directory) {
+  auto start = std::chrono::steady_clock::now();
+  m_summary = BatchSummary();
+
+  std::vector<Job> jobs;
+  if (!find_jobs(input_directory, output_directory, input_directory, jobs))
+    return false;
+
+  run_jobs(std::move(jobs));
+  m_summary.seconds = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  return true;
+}
+
+bool BatchTranspiler::transpile(const std::string &input_directory,
+                                const std::string &output_directory,
+                                const std::vector<fs::path> &inputs) {
+  auto start = std::chrono::steady_clock::now();
+  m_summary = BatchSummary();
+
+  // Inputs gone by now are left out
+  bool found = true;
+  std::vector<Job> jobs;
+  for (const fs::path &input : inputs) {
+    std::error_code error;
+    fs::directory_entry entry(input, error);
+    if (error)
+      continue;
+    if (entry.is_directory(error))
+      found = find_jobs(input_directory, output_directory, input, jobs) &&
+              found;
+    else
+      add_job(input_directory, output_directory, entry, jobs);
+  }
+
+  // Files can be given along with a directory holding them
+  std::sort(jobs.begin(), jobs.end(), [](const Job &a, const Job &b) {
+    return a.input < b.input;
+  });
+  jobs.erase(std::unique(jobs.begin(), jobs.end(),
+                         [](const Job &a, const Job &b) {
+                           return a.input == b.input;
+                         }),
+             jobs.end());
+
+  run_jobs(std::move(jobs));
+  m_summary.seconds = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  return found;
+}
+
+const BatchSummary &BatchTranspiler::summary() const {
+  return m_summary;
+}
+
+void BatchTranspiler::set_stats(TranspileStats *stats) {
+  m_stats = stats;
+}
+
+void BatchTranspiler::set_cache(const BuildCache *cache) {
+  m_cache = cache;
+}
+
+// Every Markdown file under the directory of the input tree
+bool BatchTranspiler::find_jobs(const fs::path &input_directory,
+                                const fs::path &output_directory,
+                                const fs::path &directory,
+                                std::vector<Job> &jobs) {
+  std::error_code error;
+  if (!fs::is_directory(directory, error)) {
+    report_error("Not a directory", directory.string());
+    return false;
+  }
+
+  fs::recursive_directory_iterator entries(
+      directory, fs::directory_options::skip_permission_denied, error);
+  for (; !error && entries != fs::recursive_directory_iterator();
+       entries.increment(error))
+    add_job(input_directory, output_directory, *entries, jobs);
+
+  if (error) {
+    report_error("Could not read directory", directory.string());
+    return false;
+  }
+  return true;
+}
+
+// A Markdown file of the input tree, with the path of its HTML file
+void BatchTranspiler::add_job(const fs::path &input_directory,
+                              const fs::path &output_directory,
+                              const fs::directory_entry &entry,
+                              std::vector<Job> &jobs) {
+  std::error_code error;
+  fs::path extension = entry.path().extension();
+  if ((extension != ".md" && extension != ".markdown") ||
+      !entry.is_regular_file(error))
+    return;
+
+  fs::path relative = entry.path().lexically_relative(input_directory);
+  if (relative.empty() || *relative.begin() == "..")
+    return;
+
+  fs::path output = output_directory / relative;
+  output.replace_extension(".html");
+  jobs.push_back({entry.path(), std::move(output),
+                  static_cast<size_t>(entry.file_size(error))});
+}
+
+// Runs the jobs on the pool, adding up the figures of the workers
+void BatchTranspiler::run_jobs(std::vector<Job> jobs) {
+  // Largest files first, so that the last ones to finish are short. Each
+  // thread gets every n-th file, its queue staying sorted
+  std::sort(jobs.begin(), jobs.end(), [](const Job &a, const Job &b) {
+    return a.size > b.size;
+  });
+
+  size_t thread_count =
+      std::max<size_t>(std::min(m_job_count, jobs.size()), 1);
+  while (m_workers.size() < thread_count)
+    m_workers.push_back(std::make_unique<Worker>(m_options));
+  m_queues.resize(thread_count);
+
+  for (size_t index = 0; index < thread_count; ++index) {
+    m_workers[index]->stats = TranspileStats();
+    m_workers[index]->summary = BatchSummary();
+    m_workers[index]->context.set_stats(m_stats ? &m_workers[index]->stats
+                                                : nullptr);
+    m_queues[index] = std::make_unique<Queue>();
+  }
+  for (size_t index = 0; index < jobs.size(); ++index)
+    m_queues[index % thread_count]->jobs.push_back(std::move(jobs[index]));
+
+  // The calling thread is the first worker
+  std::vector<std::thread> threads;
+  for (size_t index = 1; index < thread_count; ++index)
+    threads.emplace_back(&BatchTranspiler::work, this, index);
+  work(0);
+  for (std::thread &thread : threads)
+    thread.join();
+
+  for (size_t index = 0; index < thread_count; ++index) {
+    m_summary.add(m_workers[index]->summary);
+    if (m_stats)
+      m_stats->add(m_workers[index]->stats);
+  }
+}
+
+void BatchTranspiler::work(size_t worker_index) {
+  Worker &worker = *m_workers[worker_index];
+  Job job;
+  while (next_job(worker_index, job)) {
+    worker.summary.file_count++;
+    if (!transpile_file(worker, job))
+      worker.summary.failed_count++;
+  }
+}
+
+// The thread's own largest job left, or else the smallest job of another
+bool BatchTranspiler::next_job(size_t worker_index, Job &job) {
+  {
+    Queue &own = *m_queues[worker_index];
+    std::lock_guard lock(own.mutex);
+    if (!own.jobs.empty()) {
+      job = std::move(own.jobs.front());
+      own.jobs.pop_front();
+      return true;
+    }
+  }
+
+  // Every job is queued up front, so once all queues are empty the work is
+  // done
+  size_t thread_count = m_queues.size();
+  for (size_t offset = 1; offset < thread_count; ++offset) {
+    Queue &other = *m_queues[(worker_index + offset) % thread_count];
+    std::lock_guard lock(other.mutex);
+    if (!other.jobs.empty()) {
+      job = std::move(other.jobs.back());
+      other.jobs.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BatchTranspiler::transpile_file(Worker &worker, const Job &job) {
+  InputFile input_file;
+  if (!input_file.open(job.input.string())) {
+    report_error("Could not open input file", job.input.string());
+    return false;
+  }
+  std::string_view source = input_file.contents();
+
+  if (source.size() > TokenStream::max_source_size) {
+    report_error("Lexing failed, the input is larger than 4 GiB",
+                 job.input.string());
+    return false;
+  }
+
+  std::string title = job.input.stem().string();
+  uint64_t cache_key = 0;
+  if (m_cache) {
+    RenderOptions options = m_options;
+    options.title = title;
+    cache_key = BuildCache::key(source, options);
+
+    Status status;
+    if (m_cache->lookup(job.output, cache_key, status)) {
+      worker.summary.cached_count++;
+      if (status != Status::OK)
+        worker.summary.limited_count++;
+      return true;
+    }
+  }
+
+  std::error_code error;
+  fs::create_directories(job.output.parent_path(), error);
+  FileSink out_file;
+  if (error || !out_file.open(job.output.string())) {
+    report_error("Could not open output file", job.output.string());
+    return false;
+  }
+
+  TranspileContext &context = worker.context;
+  context.set_title(std::move(title));
+  if (!context.render(source, out_file)) {
+    report_error("Could not write output file", job.output.string());
+    return false;
+  }
+  out_file.close();
+
+  worker.summary.input_bytes += source.size();
+  worker.summary.output_bytes += out_file.written_bytes();
+  if (context.status() != Status::OK)
+    worker.summary.limited_count++;
+
+  // Only costs a rebuild the next time
+  if (m_cache)
+    m_cache->store(job.output, cache_key, context.status());
+  return true;
+}
+
+void BatchTranspiler::report_error(std::string_view message,
+                                   const std::string &path) {
+  std::lock_guard lock(m_error_mutex);
+  std::cerr << "Error: " << message << ": " << path << "\n";
+}
+
+} // namespace mt
@@ -10,375 +10,683 @@
 
 namespace mt {
 
-BlockParser::BlockParser(const std::vector<Token> &tokens)
+// Lines parsed between two looks at the clock
+static constexpr size_t deadline_check_interval = 64;
+
+BlockParser::BlockParser(const TokenStream &tokens, size_t begin, size_t end)
     : m_tokens(tokens),
-      m_index(0) {
+      m_begin(std::min(begin, tokens.size())),
+      m_end(std::min(end, tokens.size())),
+      m_index(m_begin),
+      m_block_starts(),
+      m_containers(),
+      m_leaf_kind(LeafKind::NONE),
+      m_paragraph(nullptr),
+      m_paragraph_record(0),
+      m_code_span(nullptr),
+      m_leaf_begin(0),
+      m_leaf_end(0),
+      m_leaf_gathered(false),
+      m_leaf_indices(),
+      m_code(),
+      m_code_new_line(0),
+      m_inline_parser(),
+      m_document(nullptr),
+      m_budget(nullptr),
+      m_stopped(false),
+      m_stop_offset(0) {
 }
 
 std::unique_ptr<Document> BlockParser::parse() {
   auto document = std::make_unique<Document>();
+  parse(*document);
+  return document;
+}
 
-  if (m_tokens.empty())
-    return document;
+void BlockParser::parse(Document &document) {
+  document.clear();
+  m_document = &document;
+  m_block_starts.clear();
+  m_containers.clear();
+  m_containers.push_back(
+      {ContainerKind::DOCUMENT, &document, document.flat.append(document)});
+  m_leaf_kind = LeafKind::NONE;
+  m_index = m_begin;
+  m_stopped = false;
+  m_stop_offset = 0;
+
+  if (m_begin < m_end) {
+    if (check_current_type(TokenType::START_OF_FILE))
+      advance();
 
-  if (check_current_type(TokenType::START_OF_FILE))
-    advance();
+    size_t end = m_end;
+    if (m_budget)
+      limit_tokens();
 
-  while (!at_end()) {
-    // Discarding potential initial empty lines
-    if (check_current_type(TokenType::NEW_LINE)) {
-      advance();
-      continue;
+    for (size_t line = 0; !at_end(); ++line) {
+      if (m_budget && line % deadline_check_interval == 0 &&
+          m_budget->expired()) {
+        m_stopped = true;
+        break;
+      }
+      parse_line();
     }
 
-    if (auto block = parse_block_dispatch())
-      document->children.push_back(std::move(block));
+    close_containers(1);
+    close_leaf();
+
+    if (m_stopped) {
+      m_stop_offset = source_offset(m_index);
+      add_remaining_text(end);
+    }
+    m_end = end;
   }
 
-  return document;
+  document.flat.close(m_containers.front().record);
 }
 
-std::unique_ptr<Node> BlockParser::parse_block_dispatch() {
-  // Blocks other than Paragraphs must start on a new line (unless in a list)
-  if (is_line_start()) {
-    TokenType current_type = current_token().type;
-    size_t initial_index = m_index;
+const std::vector<size_t> &BlockParser::block_starts() const {
+  return m_block_starts;
+}
 
-    // Header
-    if (current_type == TokenType::HASH) {
-      if (auto header = parse_header())
-        return header;
-      m_index = initial_index;
-    }
+void BlockParser::set_budget(Budget *budget) {
+  m_budget = budget;
+  m_inline_parser.set_budget(budget);
+}
 
-    // Code span
-    if (current_type == TokenType::BACKTICK) {
-      if (auto code_span = parse_code_span())
-        return code_span;
-      m_index = initial_index;
+bool BlockParser::stopped() const {
+  return m_stopped;
+}
+
+size_t BlockParser::stop_offset() const {
+  return m_stop_offset;
+}
+
+// Parses a single line: first its markers continuing the open containers,
+// then either the continuation of the open leaf block or new blocks
+void BlockParser::parse_line() {
+  size_t depth = match_containers();
+  bool all_matched = depth == m_containers.size();
+
+  // Code spans take every line up to their closing fence verbatim
+  if (m_leaf_kind == LeafKind::CODE_SPAN && all_matched) {
+    size_t content_index = m_index;
+    if (m_containers.size() > 1)
+      skip_whitespace();
+
+    if (is_code_span_fence()) {
+      close_leaf();
+      advance();
+      // Whatever follows the fence is a paragraph
+      if (!at_end() && !check_current_type(TokenType::NEW_LINE))
+        open_paragraph();
+    } else {
+      m_index = content_index;
+      add_code_line();
     }
 
-    // Quote
-    if (current_type == TokenType::GREATER_THAN) {
-      if (auto quote = parse_quote())
-        return quote;
-      m_index = initial_index;
+    skip_line();
+    return;
+  }
+
+  // Lazy continuation line: a paragraph goes on even if the line misses
+  // some of the markers of its containers
+  if (!all_matched && m_leaf_kind == LeafKind::PARAGRAPH) {
+    size_t line_index = m_index;
+    skip_whitespace();
+    if (!is_blank_line() && !is_block_start()) {
+      add_paragraph_line();
+      skip_line();
+      return;
     }
+    m_index = line_index;
+  }
 
-    // List
-    if ((current_type == TokenType::STAR ||
-         current_type == TokenType::HYPHEN) &&
-        peek(1).type == TokenType::SPACE) {
-      if (auto list = parse_list())
-        return list;
-      m_index = initial_index;
+  // An unmatched list item can still be followed by a sibling
+  if (!all_matched && m_containers[depth - 1].kind == ContainerKind::LIST) {
+    size_t index_offset = 0;
+    size_t indentation = count_indentation(index_offset);
+    if (is_list_marker(index_offset) &&
+        indentation >= m_containers[depth - 1].marker_indentation) {
+      close_containers(depth);
+      advance(index_offset);
+      open_list_item(indentation);
+      depth = m_containers.size();
+    } else {
+      depth--;
     }
   }
 
-  // If not parsed as anything special up to this point,
-  // it's assumed it's a paragraph
-  return parse_paragraph();
-}
+  close_containers(depth);
 
-// Individual parser implementations
-std::unique_ptr<Heading> BlockParser::parse_header() {
-  uint8_t hash_char_count = 0;
-  while (check_current_type(TokenType::HASH)) {
-    hash_char_count++;
-    advance();
+  if (is_blank_line()) {
+    close_leaf();
+    skip_line();
+    return;
   }
 
-  if (hash_char_count == 0 || hash_char_count > 6 ||
-      !check_current_type(TokenType::SPACE))
-    return nullptr;
-  advance(); // space
+  parse_block_starts();
+  skip_line();
+}
 
-  auto header = std::make_unique<Heading>(hash_char_count);
+// Consumes the markers of the open containers the line continues and
+// returns how many containers, the document included, it continues
+size_t BlockParser::match_containers() {
+  // Items measure the same indentation up to the next quote marker
+  bool measured = false;
+  bool blank = false;
+  size_t indentation = 0;
 
-  while (!at_end() && !check_current_type(TokenType::NEW_LINE)) {
-    header->tokens.push_back(current_token());
-    advance();
+  size_t depth = 1;
+  for (; depth < m_containers.size(); ++depth) {
+    const Container &container = m_containers[depth];
+    if (container.kind == ContainerKind::QUOTE) {
+      if (!match_quote_marker())
+        break;
+      measured = false;
+    } else if (container.kind == ContainerKind::LIST_ITEM) {
+      if (!measured) {
+        size_t index_offset = 0;
+        indentation = count_indentation(index_offset);
+        blank = at_end(index_offset) ||
+                m_tokens.type(m_index + index_offset) == TokenType::NEW_LINE;
+        measured = true;
+      }
+      // Items go on through blank lines and lines indented past their marker
+      if (!blank && indentation <= container.marker_indentation)
+        break;
+    }
+    // Lists are continued through their items
   }
 
-  header->children = InlineParser::parse(header->tokens);
+  return depth;
+}
+
+bool BlockParser::match_quote_marker() {
+  size_t index_offset = 0;
+  count_indentation(index_offset);
+  if (at_end(index_offset) ||
+      m_tokens.type(m_index + index_offset) != TokenType::GREATER_THAN)
+    return false;
 
-  return header;
+  advance(index_offset + 1);
+  return true;
 }
 
-std::unique_ptr<CodeSpan> BlockParser::parse_code_span() {
-  int backtick_char_count = 0;
-  while (check_current_type(TokenType::BACKTICK)) {
-    backtick_char_count++;
-    advance();
-  }
+// Opens the blocks starting at the current token, nesting containers
+// for as long as their markers follow each other
+void BlockParser::parse_block_starts() {
+  while (true) {
+    // Blocks directly in the document must start on a new line
+    bool in_container = m_containers.size() > 1;
+    size_t index_offset = 0;
+    size_t indentation = count_indentation(index_offset);
+    if (in_container)
+      advance(index_offset);
 
-  if (backtick_char_count != 3)
-    return nullptr;
+    if (at_end() || check_current_type(TokenType::NEW_LINE))
+      return;
 
-  std::string language{};
-  if (check_current_type(TokenType::TEXT)) {
-    language = current_token().literal;
-    advance();
-  }
+    size_t block_start = m_index;
+    TokenType current_type = current_token().type;
 
-  while (check_current_type(TokenType::NEW_LINE))
-    advance();
+    // Quote
+    if (current_type == TokenType::GREATER_THAN && can_nest(1)) {
+      close_leaf();
+      advance();
+      open_container(ContainerKind::QUOTE,
+                     m_document->arena.create<BlockQuote>(), block_start);
+      continue;
+    }
 
-  auto code_span = std::make_unique<CodeSpan>(language);
-  while (!at_end()) {
-    if (check_current_type(TokenType::BACKTICK) && is_line_start()) {
-      if (peek(1).type == TokenType::BACKTICK &&
-          peek(2).type == TokenType::BACKTICK) {
-        advance(3);
-        break;
-      }
+    // List
+    if (is_list_marker(0) && can_nest(2)) {
+      close_leaf();
+      open_container(ContainerKind::LIST, m_document->arena.create<List>(),
+                     block_start, indentation);
+      open_list_item(indentation);
+      continue;
     }
-    code_span->tokens.push_back(current_token());
-    advance();
+
+    // Header
+    if (current_type == TokenType::HASH) {
+      if (parse_header(block_start))
+        return;
+      m_index = block_start;
+    }
+
+    // Code span
+    if (current_type == TokenType::BACKTICK &&
+        current_token().count() == 3) {
+      close_leaf();
+      open_code_span();
+      return;
+    }
+
+    // If not parsed as anything special up to this point, it's assumed it's
+    // a paragraph. Lines starting like another block still interrupt one
+    if (m_leaf_kind == LeafKind::PARAGRAPH && !is_block_start()) {
+      add_paragraph_line();
+    } else {
+      close_leaf();
+      open_paragraph();
+    }
+    return;
   }
+}
 
-  // Getting rid of a potential empty line at the back
-  if (!code_span->tokens.empty() &&
-      code_span->tokens.back().type == TokenType::NEW_LINE)
-    code_span->tokens.pop_back();
+// Whether the line goes on with something other than a paragraph line
+bool BlockParser::is_block_start() const {
+  TokenType current_type = current_token().type;
+  return !at_end() && (current_type == TokenType::GREATER_THAN ||
+                       current_type == TokenType::HASH ||
+                       current_type == TokenType::BACKTICK ||
+                       is_list_marker(0));
+}
 
-  return code_span;
+// Parses only as many whole lines as the tokens left in the budget allow
+void BlockParser::limit_tokens() {
+  size_t remaining = m_budget->remaining_tokens();
+  if (m_end - m_index <= remaining)
+    return;
+
+  size_t end = m_index + remaining;
+  while (end > m_index && m_tokens.type(end - 1) != TokenType::NEW_LINE)
+    end--;
+
+  m_end = end;
+  m_stopped = true;
+  m_budget->exceed(Status::TOKEN_LIMIT);
 }
 
-std::unique_ptr<BlockQuote> BlockParser::parse_quote() {
-  std::vector<Token> quote_tokens;
+// Whether the given number of containers can be opened within the depth
+// limit, lines starting deeper containers are paragraphs instead
+bool BlockParser::can_nest(size_t container_count) {
+  if (!m_budget || !m_budget->limits().max_depth ||
+      m_containers.size() - 1 + container_count <=
+          m_budget->limits().max_depth)
+    return true;
 
-  while (!at_end()) {
-    size_t quote_index_offset = 0;
-    while (peek(quote_index_offset).type == TokenType::SPACE ||
-           peek(quote_index_offset).type == TokenType::TAB)
-      quote_index_offset++;
+  m_budget->exceed(Status::DEPTH_LIMIT);
+  return false;
+}
 
-    if (peek(quote_index_offset).type == TokenType::GREATER_THAN) {
-      advance(quote_index_offset); // SPACE char
-      advance();                   // '>' char
+// Adds the input from the current line up to the token at the given index
+// as the text of a top-level paragraph
+void BlockParser::add_remaining_text(size_t end) {
+  size_t begin_offset = source_offset(m_index);
+  size_t end_offset = source_offset(end);
+  std::string_view text =
+      m_tokens.source().substr(begin_offset, end_offset - begin_offset);
+
+  // Leaving out the blank lines around it
+  size_t first = text.find_first_not_of(" \t\r\n");
+  if (first == std::string_view::npos)
+    return;
+  text = text.substr(first, text.find_last_not_of(" \t\r\n") + 1 - first);
+
+  m_block_starts.push_back(m_index);
+  auto *paragraph = m_document->add<Paragraph>(*m_document);
+  uint32_t record = static_cast<uint32_t>(m_document->flat.size() - 1);
+  m_document->add<Text>(*paragraph, text);
+  m_document->flat.close(record);
+}
 
-      if (check_current_type(TokenType::SPACE))
-        advance();
+// Containers
+// Appends the block to the innermost container, returning its record
+uint32_t BlockParser::add_block(Node *block, size_t block_start) {
+  if (m_containers.size() == 1)
+    m_block_starts.push_back(block_start);
+  m_containers.back().node->append_child(block);
+  return m_document->flat.append(*block);
+}
 
-      while (!at_end() && !check_current_type(TokenType::NEW_LINE)) {
-        quote_tokens.push_back(current_token());
-        advance();
-      }
-    } else {
-      break;
-    }
-  }
+void BlockParser::open_container(ContainerKind kind, Node *node,
+                                 size_t block_start, size_t marker_indentation,
+                                 size_t content_indentation) {
+  uint32_t record = add_block(node, block_start);
+  m_containers.push_back(
+      {kind, node, record, marker_indentation, content_indentation});
+}
 
-  BlockParser quote_tokens_parser(quote_tokens);
-  auto inner_quote_doc = quote_tokens_parser.parse();
+// Closes the containers from the given depth down, with their leaf block
+void BlockParser::close_containers(size_t depth) {
+  if (depth >= m_containers.size())
+    return;
 
-  auto quote = std::make_unique<BlockQuote>();
-  quote->children = std::move(inner_quote_doc->children);
+  close_leaf();
+  for (size_t index = depth; index < m_containers.size(); ++index)
+    m_document->flat.close(m_containers[index].record);
+  m_containers.erase(m_containers.begin() + depth, m_containers.end());
+}
 
-  return quote;
+// Skips a list marker and its spaces, opening an item in the innermost list
+void BlockParser::open_list_item(size_t marker_indentation) {
+  advance(); // marker
+  size_t space_count = current_token().count();
+  advance(); // spaces
+
+  // Code lines of the item are stripped of the indentation of its content
+  size_t content_indentation =
+      marker_indentation + 1 + (space_count > 4 ? 1 : space_count);
+  open_container(ContainerKind::LIST_ITEM, m_document->arena.create<ListItem>(),
+                 m_index, marker_indentation, content_indentation);
 }
 
-std::unique_ptr<List> BlockParser::parse_list(size_t current_indentation) {
-  auto list = std::make_unique<List>();
+// Leaf blocks
+// Adds a header, closing the open leaf block, if the line is one
+bool BlockParser::parse_header(size_t block_start) {
+  if (!check_current_type(TokenType::HASH))
+    return false;
 
-  while (!at_end()) {
-    // Checking the indentation and the list marker (- or *)
-    size_t index_offset = 0;
-    size_t indentation = count_list_indentation(index_offset);
+  size_t hash_char_count = current_token().count();
+  advance();
 
-    // Is it a part of this list
-    if (indentation < current_indentation)
-      break;
+  if (hash_char_count > 6 || !check_current_type(TokenType::SPACE))
+    return false;
+  advance(); // spaces
 
-    // Checking if the list grammar is correct
-    TokenType list_element_marker = peek(index_offset).type;
-    if ((list_element_marker != TokenType::HYPHEN &&
-         list_element_marker != TokenType::STAR) ||
-        peek(index_offset + 1).type != TokenType::SPACE)
-      break;
+  close_leaf();
+  auto *header = m_document->arena.create<Heading>(
+      static_cast<uint8_t>(hash_char_count));
+  uint32_t record = add_block(header, block_start);
 
-    // Skipping the indentation, marker and space chars
-    advance(index_offset + 2);
-    auto list_item = std::make_unique<ListItem>();
-
-    // Item parsing
-    bool is_first_line = true;
-    while (!at_end()) {
-      if (!is_first_line) {
-        if (check_current_type(TokenType::NEW_LINE)) {
-          advance();
-          continue;
-        }
-
-        size_t next_item_index_offset = 0;
-        size_t next_indentation =
-            count_list_indentation(next_item_index_offset);
-
-        // The end of the item of the list
-        if (next_indentation <= current_indentation)
-          break;
-
-        TokenType next_list_item_marker = peek(next_item_index_offset).type;
-
-        if ((next_list_item_marker == TokenType::HYPHEN ||
-             next_list_item_marker == TokenType::STAR) &&
-            peek(next_item_index_offset + 1).type == TokenType::SPACE) {
-          list_item->children.push_back(parse_list(next_indentation));
-          continue;
-        }
-
-        advance(next_item_index_offset);
-      }
+  size_t tokens_begin = m_index;
+  m_index = line_end();
 
-      list_item->children.push_back(parse_list_item());
+  header->tokens = TokenRange(m_tokens, tokens_begin, m_index);
+  m_inline_parser.parse(header->tokens, *header, *m_document);
+  m_document->flat.close(record);
 
-      if (check_current_type(TokenType::NEW_LINE))
-        advance();
-      is_first_line = false;
-    }
+  return true;
+}
 
-    list->children.push_back(std::move(list_item));
-  }
+// Opens a paragraph with the rest of the current line
+void BlockParser::open_paragraph() {
+  m_paragraph = m_document->arena.create<Paragraph>();
+  m_paragraph_record = add_block(m_paragraph, m_index);
 
-  return list;
+  m_leaf_kind = LeafKind::PARAGRAPH;
+  m_leaf_begin = m_index;
+  m_leaf_gathered = false;
+  m_index = line_end();
+  m_leaf_end = m_index;
 }
 
-std::unique_ptr<Node> BlockParser::parse_list_item() {
-  size_t initial_index = m_index;
+// Adds the rest of the current line to the open paragraph, joined to its
+// previous line by that line's new line token
+void BlockParser::add_paragraph_line() {
+  size_t line_begin = m_index;
+  m_index = line_end();
 
-  // Header
-  if (check_current_type(TokenType::HASH)) {
-    if (auto header = parse_header())
-      return header;
-    m_index = initial_index;
+  if (!m_leaf_gathered && line_begin == m_leaf_end + 1) {
+    m_leaf_end = m_index;
+    return;
   }
 
-  // Quote
-  if (check_current_type(TokenType::GREATER_THAN)) {
-    if (auto quote = parse_quote())
-      return quote;
-    m_index = initial_index;
+  // Container markers split the lines, their tokens are picked one by one
+  if (!m_leaf_gathered) {
+    m_leaf_indices.resize(m_leaf_end - m_leaf_begin);
+    std::iota(m_leaf_indices.begin(), m_leaf_indices.end(),
+              static_cast<uint32_t>(m_leaf_begin));
+    m_leaf_gathered = true;
   }
 
-  // Code Span
-  if (check_current_type(TokenType::BACKTICK)) {
-    if (auto code_span = parse_code_span())
-      return code_span;
-    m_index = initial_index;
+  m_leaf_indices.push_back(static_cast<uint32_t>(m_leaf_end));
+  for (size_t index = line_begin; index < m_index; ++index)
+    m_leaf_indices.push_back(static_cast<uint32_t>(index));
+  m_leaf_end = m_index;
+}
+
+void BlockParser::close_paragraph() {
+  if (m_leaf_gathered) {
+    std::span<uint32_t> indices =
+        m_document->arena.copy(std::span<const uint32_t>(m_leaf_indices));
+    m_paragraph->tokens =
+        TokenRange(m_tokens, indices.data(), 0, indices.size());
+  } else {
+    m_paragraph->tokens = TokenRange(m_tokens, m_leaf_begin, m_leaf_end);
   }
 
-  // If not a special list item,
-  // it's assumed it is a paragraph
-  auto paragraph = std::make_unique<Paragraph>();
-  while (!at_end() && !check_current_type(TokenType::NEW_LINE)) {
-    paragraph->tokens.push_back(current_token());
+  m_inline_parser.parse(m_paragraph->tokens, *m_paragraph, *m_document);
+  m_document->flat.close(m_paragraph_record);
+}
+
+// Opens a code span at its opening fence, the rest of the line after the
+// language already being code
+void BlockParser::open_code_span() {
+  size_t block_start = m_index;
+  advance();
+
+  std::string_view language{};
+  if (check_current_type(TokenType::TEXT)) {
+    language = current_token().literal;
     advance();
   }
 
-  paragraph->children = InlineParser::parse(paragraph->tokens);
+  // Its record is only appended once its code is known, in close_leaf
+  m_code_span = m_document->arena.create<CodeSpan>(language);
+  if (m_containers.size() == 1)
+    m_block_starts.push_back(block_start);
+  m_containers.back().node->append_child(m_code_span);
+  m_leaf_kind = LeafKind::CODE_SPAN;
+  m_code.clear();
+
+  if (!at_end() && !check_current_type(TokenType::NEW_LINE)) {
+    size_t content_offset = source_offset(m_index);
+    m_index = line_end();
+    m_code_new_line = source_offset(m_index);
+    m_code.push_back(m_tokens.source().substr(
+        content_offset, m_code_new_line - content_offset));
+  }
+}
+
+// Adds the rest of the current line to the open code span, stripped of the
+// indentation belonging to its container
+void BlockParser::add_code_line() {
+  std::string_view source = m_tokens.source();
+  size_t content_offset = source_offset(m_index);
+  m_index = line_end();
+  size_t end_offset = source_offset(m_index);
+
+  size_t strip_indentation = 0;
+  const Container &container = m_containers.back();
+  if (container.kind == ContainerKind::QUOTE)
+    strip_indentation = 1;
+  else if (container.kind == ContainerKind::LIST_ITEM)
+    strip_indentation = container.content_indentation;
+
+  while (content_offset < end_offset && strip_indentation > 0) {
+    size_t width = source[content_offset] == ' '    ? 1
+                   : source[content_offset] == '\t' ? 4
+                                                    : 0;
+    if (width == 0 || width > strip_indentation)
+      break;
+    strip_indentation -= width;
+    content_offset++;
+  }
+
+  std::vector<std::string_view> &code = m_code;
+  if (code.empty()) {
+    // Discarding empty lines in front of the code
+    if (content_offset == end_offset)
+      return;
+    code.push_back(source.substr(content_offset, end_offset - content_offset));
+  } else if (content_offset == m_code_new_line + 1) {
+    // Following the previous line directly, through its new line
+    std::string_view &last = code.back();
+    last = source.substr(last.data() - source.data(),
+                         end_offset - (last.data() - source.data()));
+  } else {
+    std::string_view &last = code.back();
+    last = std::string_view(last.data(), last.size() + 1);
+    code.push_back(source.substr(content_offset, end_offset - content_offset));
+  }
+
+  m_code_new_line = end_offset;
+}
+
+// A closing fence is a run of at least three backticks
+bool BlockParser::is_code_span_fence() const {
+  return check_current_type(TokenType::BACKTICK) &&
+         current_token().count() >= 3;
+}
 
-  return paragraph;
+void BlockParser::close_leaf() {
+  if (m_leaf_kind == LeafKind::PARAGRAPH)
+    close_paragraph();
+  else if (m_leaf_kind == LeafKind::CODE_SPAN) {
+    m_code_span->code =
+        m_document->arena.copy(std::span<const std::string_view>(m_code));
+    m_document->flat.append(*m_code_span);
+  }
+  m_leaf_kind = LeafKind::NONE;
 }
 
-size_t BlockParser::count_list_indentation(size_t &index_offset) const {
+// Lines
+size_t BlockParser::count_indentation(size_t &index_offset) const {
   size_t indentation = 0;
   index_offset = 0;
 
-  while (peek(index_offset).type == TokenType::SPACE ||
-         peek(index_offset).type == TokenType::TAB) {
-    indentation += (peek(index_offset).type == TokenType::TAB ? 4 : 1);
+  while (!at_end(index_offset)) {
+    size_t index = m_index + index_offset;
+    TokenType type = m_tokens.type(index);
+    if (type != TokenType::SPACE && type != TokenType::TAB)
+      break;
+    indentation += m_tokens.length(index) * (type == TokenType::TAB ? 4 : 1);
     index_offset++;
   }
 
   return indentation;
 }
 
-std::unique_ptr<Paragraph> BlockParser::parse_paragraph() {
-  auto paragraph = std::make_unique<Paragraph>();
-
-  while (!at_end()) {
-    if (check_current_type(TokenType::NEW_LINE)) {
-      if (peek(-1).type == TokenType::NEW_LINE) {
-        advance();
-        break;
-      }
-
-      TokenType next_token_type = peek(1).type;
-
-      if ((next_token_type == TokenType::HYPHEN ||
-           next_token_type == TokenType::STAR) &&
-          peek(2).type == TokenType::SPACE) {
-        advance();
-        break;
-      }
-
-      if (next_token_type == TokenType::GREATER_THAN) {
-        advance();
-        break;
-      }
+// A single '-' or '*' followed by spaces
+bool BlockParser::is_list_marker(size_t index_offset) const {
+  if (at_end(index_offset + 1))
+    return false;
+  size_t index = m_index + index_offset;
+  TokenType type = m_tokens.type(index);
+  return (type == TokenType::HYPHEN || type == TokenType::STAR) &&
+         m_tokens.length(index) == 1 &&
+         m_tokens.type(index + 1) == TokenType::SPACE;
+}
 
-      if (next_token_type == TokenType::HASH) {
-        advance();
-        break;
-      }
+bool BlockParser::is_blank_line() const {
+  size_t index_offset = 0;
+  count_indentation(index_offset);
+  return at_end(index_offset) ||
+         m_tokens.type(m_index + index_offset) == TokenType::NEW_LINE;
+}
 
-      if (next_token_type == TokenType::BACKTICK) {
-        advance();
-        break;
-      }
+void BlockParser::skip_whitespace() {
+  size_t index_offset = 0;
+  count_indentation(index_offset);
+  advance(index_offset);
+}
 
-      paragraph->tokens.push_back(current_token());
-      advance();
-      continue;
-    }
-    paragraph->tokens.push_back(current_token());
+// Moves past the new line ending the current line
+void BlockParser::skip_line() {
+  m_index = line_end();
+  if (check_current_type(TokenType::NEW_LINE))
     advance();
-  }
+}
 
-  paragraph->children = InlineParser::parse(paragraph->tokens);
+// Index of the new line (or end of file) token ending the current line
+size_t BlockParser::line_end() const {
+  size_t index = m_index;
+  while (index < m_end && m_tokens.type(index) != TokenType::NEW_LINE &&
+         m_tokens.type(index) != TokenType::END_OF_FILE)
+    index++;
+  return index;
+}
 
-  return paragraph;
+size_t BlockParser::source_offset(size_t index) const {
+  return index < m_tokens.size() ? m_tokens.offset(index)
+                                 : m_tokens.source().size();
 }
 
 bool BlockParser::at_end(size_t index_offset) const {
-  return (m_index + index_offset) >= m_tokens.size() ||
-         m_tokens[m_index + index_offset].type == TokenType::END_OF_FILE;
+  return (m_index + index_offset) >= m_end ||
+         m_tokens.type(m_index + index_offset) == TokenType::END_OF_FILE;
 }
 
-const Token &BlockParser::current_token() const {
-  return m_tokens[m_index];
+Token BlockParser::current_token() const {
+  return peek(0);
 }
 
-const Token &BlockParser::peek(size_t index_offset) const {
+// Peeking outside of the parsed range yields its last token
+Token BlockParser::peek(size_t index_offset) const {
   size_t peek_index = m_index + index_offset;
-  if (m_tokens.empty()) {
-    if (!m_tokens.empty())
-      return m_tokens.front();
-    static Token token = Token();
-    return token;
-  }
-  if (peek_index >= m_tokens.size()) {
-    return m_tokens.back();
+  if (m_begin == m_end)
+    return Token();
+  if (peek_index < m_begin || peek_index >= m_end) {
+    return m_tokens[m_end - 1];
   }
 
   return m_tokens[peek_index];
 }
 
 void BlockParser::advance(size_t n) {
-  m_index = std::min(m_index + n, m_tokens.size());
+  m_index = std::min(m_index + n, m_end);
 }
 
 bool BlockParser::check_current_type(TokenType type) const {
-  return !at_end() && current_token().type == type;
+  return !at_end() && m_tokens.type(m_index) == type;
 }
 
-bool BlockParser::is_line_start() const {
-  if (m_index == 0)
-    return true;
-  TokenType previous_type = peek(-1).type;
-  return previous_type == TokenType::NEW_LINE ||
-         previous_type == TokenType::START_OF_FILE;
+std::vector<size_t> SplitScanner::split_points(std::string_view markdown,
+                                               size_t part_size) {
+  std::vector<size_t> points;
+  SplitScanner scanner;
+  size_t next_point = part_size;
+
+  size_t line_begin = 0;
+  while (line_begin < markdown.size()) {
+    size_t line_end = markdown.find('\n', line_begin);
+    if (line_end == std::string_view::npos)
+      line_end = markdown.size();
+    std::string_view line = markdown.substr(line_begin, line_end - line_begin);
+
+    if (line_begin >= next_point && scanner.can_split_before(line)) {
+      points.push_back(line_begin);
+      next_point = line_begin + part_size;
+    }
+    scanner.add_line(line);
+    line_begin = line_end + 1;
+  }
+
+  return points;
+}
+
+// Containers stay open through blank lines only for indented lines and list
+// items, and the blank line closed any paragraph
+// The lexer drops carriage returns, so those a line starts with don't
+// count
+static std::string_view skip_carriage_returns(std::string_view line) {
+  line.remove_prefix(std::min(line.find_first_not_of('\r'), line.size()));
+  return line;
+}
+
+bool SplitScanner::can_split_before(std::string_view line) const {
+  line = skip_carriage_returns(line);
+  char first = line.empty() ? '\n' : line.front();
+  return m_after_blank_line && !m_in_code_span &&
+         std::string_view(" \t\r\n-*").find(first) == std::string_view::npos;
+}
+
+void SplitScanner::add_line(std::string_view line) {
+  line = skip_carriage_returns(line);
+  // Fences at the first column are always top-level, opened by exactly
+  // three backticks and closed by at least three
+  size_t backtick_count = line.find_first_not_of('`');
+  if (backtick_count == std::string_view::npos)
+    backtick_count = line.size();
+  if (m_in_code_span ? backtick_count >= 3 : backtick_count == 3)
+    m_in_code_span = !m_in_code_span;
+
+  m_after_blank_line =
+      !m_in_code_span &&
+      line.find_first_not_of(" \t\r") == std::string_view::npos;
 }
 
 } // namespace mt
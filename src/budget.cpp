@@ -0,0 +1,71 @@
+#include "budget.hpp"
+
+#include <limits>
+
+namespace mt {
+
+std::string_view status_name(Status status) {
+  switch (status) {
+  case Status::OK:
+    return "ok";
+  case Status::DEPTH_LIMIT:
+    return "depth limit";
+  case Status::TOKEN_LIMIT:
+    return "token limit";
+  case Status::OUTPUT_LIMIT:
+    return "output limit";
+  case Status::DEADLINE:
+    return "deadline";
+  }
+  return "unknown";
+}
+
+Budget::Budget(Limits limits)
+    : m_limits(limits),
+      m_deadline(),
+      m_status(Status::OK),
+      m_tokens(0) {
+  start();
+}
+
+void Budget::start() {
+  m_deadline = m_limits.deadline.count() ? Clock::now() + m_limits.deadline
+                                         : Clock::time_point::max();
+  m_status = Status::OK;
+  m_tokens = 0;
+}
+
+const Limits &Budget::limits() const {
+  return m_limits;
+}
+
+void Budget::exceed(Status status) {
+  if (m_status == Status::OK)
+    m_status = status;
+}
+
+Status Budget::status() const {
+  return m_status;
+}
+
+bool Budget::expired() {
+  if (m_status == Status::DEADLINE)
+    return true;
+  if (m_deadline == Clock::time_point::max() || Clock::now() < m_deadline)
+    return false;
+
+  exceed(Status::DEADLINE);
+  return true;
+}
+
+size_t Budget::remaining_tokens() const {
+  if (!m_limits.max_tokens)
+    return std::numeric_limits<size_t>::max();
+  return m_tokens < m_limits.max_tokens ? m_limits.max_tokens - m_tokens : 0;
+}
+
+void Budget::add_tokens(size_t count) {
+  m_tokens += count;
+}
+
+} // namespace mt
@@ -0,0 +1,242 @@
+#include "build_cache.hpp"
+
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+#ifndef MT_VERSION
+#define MT_VERSION "unknown"
+#endif
+
+namespace mt {
+
+namespace fs = std::filesystem;
+
+// Changes whenever the entries are written differently
+static constexpr std::string_view entry_header = "mtcache 1";
+
+// Changes whenever the same Markdown renders into different HTML, which
+// the version alone doesn't follow between releases
+static constexpr unsigned renderer_revision = 1;
+
+static constexpr uint64_t hash_multiplier = 0x9e3779b97f4a7c15;
+
+// Final mix of splitmix64, spreading every bit over the whole word
+static uint64_t mix(uint64_t value) {
+  value ^= value >> 30;
+  value *= 0xbf58476d1ce4e5b9;
+  value ^= value >> 27;
+  value *= 0x94d049bb133111eb;
+  value ^= value >> 31;
+  return value;
+}
+
+uint64_t hash_bytes(std::string_view data, uint64_t seed) {
+  uint64_t hash = mix(seed ^ (data.size() * hash_multiplier));
+
+  size_t index = 0;
+  for (; index + 8 <= data.size(); index += 8) {
+    uint64_t word;
+    std::memcpy(&word, data.data() + index, 8);
+    hash = std::rotl((hash ^ word) * hash_multiplier, 29);
+  }
+
+  if (index < data.size()) {
+    uint64_t word = 0;
+    std::memcpy(&word, data.data() + index, data.size() - index);
+    hash = std::rotl((hash ^ word) * hash_multiplier, 29);
+  }
+
+  return mix(hash);
+}
+
+BuildCache::BuildCache(fs::path directory)
+    : m_directory(std::move(directory)) {
+}
+
+uint64_t BuildCache::key(std::string_view markdown,
+                         const RenderOptions &options) {
+  std::ostringstream settings;
+  settings << MT_VERSION << ' ' << renderer_revision << '\n'
+           << options.title << '\n'
+           << options.use_default_style << options.only_body << '\n'
+           << options.limits.max_depth << ' ' << options.limits.max_tokens
+           << ' ' << options.limits.max_output_bytes << ' '
+           << options.limits.deadline.count();
+
+  return hash_bytes(markdown, hash_bytes(settings.str()));
+}
+
+// The absolute path of the output, which names its entry
+static bool absolute_path(const fs::path &output, std::string &path) {
+  std::error_code error;
+  fs::path absolute_output = fs::absolute(output, error);
+  if (error)
+    return false;
+  path = absolute_output.lexically_normal().string();
+  return true;
+}
+
+bool BuildCache::lookup(const fs::path &output, uint64_t key,
+                        Status &status) const {
+  std::string path;
+  if (!absolute_path(output, path))
+    return false;
+
+  Entry entry;
+  bool found = false;
+  {
+    std::lock_guard lock(m_mutex);
+    auto memory_entry = m_entries.find(path);
+    if (memory_entry != m_entries.end()) {
+      entry = memory_entry->second;
+      found = true;
+    }
+  }
+  if (!found) {
+    if (m_directory.empty() || !read_entry(path, entry))
+      return false;
+    std::lock_guard lock(m_mutex);
+    m_entries[path] = entry;
+  }
+  if (entry.key != key)
+    return false;
+
+  // The output file has to be the one written then
+  std::error_code error;
+  uintmax_t size = fs::file_size(path, error);
+  if (error || size != entry.size)
+    return false;
+  auto time = fs::last_write_time(path, error);
+  if (error || time.time_since_epoch().count() != entry.time)
+    return false;
+
+  status = entry.status;
+  return true;
+}
+
+bool BuildCache::store(const fs::path &output, uint64_t key,
+                       Status status) const {
+  std::string path;
+  if (!absolute_path(output, path))
+    return false;
+
+  // Where the deadline cuts the page depends on the timing, so it's
+  // rendered again next time instead
+  if (status == Status::DEADLINE) {
+    {
+      std::lock_guard lock(m_mutex);
+      m_entries.erase(path);
+    }
+    std::error_code error;
+    if (!m_directory.empty())
+      fs::remove(entry_path(path), error);
+    return !error;
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.status = status;
+  std::error_code error;
+  entry.size = fs::file_size(path, error);
+  if (error)
+    return false;
+  auto time = fs::last_write_time(path, error);
+  if (error)
+    return false;
+  entry.time = static_cast<long long>(time.time_since_epoch().count());
+
+  {
+    std::lock_guard lock(m_mutex);
+    m_entries[path] = entry;
+  }
+  return m_directory.empty() || write_entry(path, entry);
+}
+
+const fs::path &BuildCache::directory() const {
+  return m_directory;
+}
+
+// An entry file holds the key, the status, the size and modification time
+// of the output file and its path, one per line
+bool BuildCache::read_entry(const std::string &output_path,
+                            Entry &entry) const {
+  std::ifstream file(entry_path(output_path), std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  std::string header;
+  unsigned entry_status = 0;
+  std::string entry_output;
+  std::getline(file, header);
+  file >> std::hex >> entry.key >> std::dec >> entry_status >> entry.size >>
+      entry.time;
+  file.ignore(1);
+  std::getline(file, entry_output);
+  if (!file || header != entry_header || entry_output != output_path ||
+      entry_status > static_cast<unsigned>(Status::DEADLINE))
+    return false;
+
+  entry.status = static_cast<Status>(entry_status);
+  return true;
+}
+
+bool BuildCache::write_entry(const std::string &output_path,
+                             const Entry &entry) const {
+  std::error_code error;
+  fs::create_directories(m_directory, error);
+  if (error)
+    return false;
+
+  // Written next to the entry under a name of its own, then put in its
+  // place at once, so readers never see half of an entry. Threads of other
+  // processes can have the same id, hence the random token
+  static const unsigned process_token = std::random_device()();
+  static std::atomic<uint64_t> written_count{0};
+  fs::path path = entry_path(output_path);
+  std::ostringstream suffix;
+  suffix << '.' << process_token << '.'
+         << std::hash<std::thread::id>()(std::this_thread::get_id())
+         << '.' << written_count++ << ".tmp";
+  fs::path temporary = path;
+  temporary += suffix.str();
+
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file << entry_header << '\n'
+         << std::hex << entry.key << std::dec << '\n'
+         << static_cast<unsigned>(entry.status) << '\n'
+         << entry.size << '\n'
+         << entry.time << '\n'
+         << output_path << '\n';
+    if (!file.flush()) {
+      file.close();
+      fs::remove(temporary, error);
+      return false;
+    }
+  }
+
+  fs::rename(temporary, path, error);
+  if (error) {
+    fs::remove(temporary, error);
+    return false;
+  }
+  return true;
+}
+
+// Entries are named after the hash of the absolute output path
+fs::path BuildCache::entry_path(const std::string &output) const {
+  char name[16];
+  auto [end, error] =
+      std::to_chars(name, name + sizeof(name), hash_bytes(output), 16);
+  return m_directory / std::string(name, end);
+}
+
+} // namespace mt
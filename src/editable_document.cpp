@@ -0,0 +1,200 @@
+#include "editable_document.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "block_parser.hpp"
+
+namespace mt {
+
+EditableDocument::EditableDocument(RenderOptions options, size_t part_size)
+    : m_lexer(),
+      m_renderer(std::move(options.title),
+                 options.use_default_style,
+                 options.only_body),
+      m_part_size(std::max<size_t>(part_size, 1)),
+      m_parts(),
+      m_part_offsets{0} {
+}
+
+void EditableDocument::set_text(std::string_view markdown) {
+  replace_parts(0, m_parts.size(), markdown);
+}
+
+// The parts touched by the edit are put together with it applied, then
+// grown by their neighbours until the text starts where a part could start
+// and ends where the next untouched part can begin: after a blank line and
+// outside of any code span, which every open block is closed by
+EditedBlocks EditableDocument::edit(size_t begin, size_t end,
+                                    std::string_view replacement) {
+  end = std::min(end, size());
+  begin = std::min(begin, end);
+
+  size_t first = find_part(begin);
+  size_t last = std::min(find_part(end) + 1, m_parts.size());
+
+  std::string text;
+  if (first < last) {
+    text.reserve(m_part_offsets[last] - m_part_offsets[first] -
+                 (end - begin) + replacement.size());
+    std::string_view first_source = m_parts[first]->source;
+    std::string_view last_source = m_parts[last - 1]->source;
+    text.append(first_source.substr(0, begin - m_part_offsets[first]));
+    text.append(replacement);
+    text.append(last_source.substr(end - m_part_offsets[last - 1]));
+  } else {
+    text.append(replacement);
+  }
+
+  // The part before ends with a blank line outside of code spans, so only
+  // the first line can keep the text from starting a part of its own
+  SplitScanner start_scanner;
+  start_scanner.add_line("");
+  while (first > 0 && !text.empty() &&
+         !start_scanner.can_split_before(
+             std::string_view(text).substr(0, text.find('\n')))) {
+    --first;
+    text.insert(0, m_parts[first]->source);
+  }
+
+  SplitScanner scanner;
+  size_t scanned = 0;
+  while (last < m_parts.size() && !text.empty()) {
+    size_t line_end;
+    while ((line_end = text.find('\n', scanned)) != std::string::npos) {
+      scanner.add_line(std::string_view(text).substr(scanned,
+                                                     line_end - scanned));
+      scanned = line_end + 1;
+    }
+
+    std::string_view next_source = m_parts[last]->source;
+    if (scanned == text.size() &&
+        scanner.can_split_before(
+            next_source.substr(0, next_source.find('\n'))))
+      break;
+    text.append(next_source);
+    ++last;
+  }
+
+  EditedBlocks blocks;
+  blocks.first = block_count(0, first);
+  blocks.removed_count = block_count(first, last);
+  size_t added_parts = replace_parts(first, last, text);
+  blocks.added_count = block_count(first, first + added_parts);
+  return blocks;
+}
+
+std::string EditableDocument::text() const {
+  std::string text;
+  text.reserve(size());
+  for (const auto &part : m_parts)
+    text.append(part->source);
+  return text;
+}
+
+size_t EditableDocument::size() const {
+  return m_part_offsets.back();
+}
+
+std::string EditableDocument::render() {
+  m_renderer.clear();
+  m_renderer.begin_page();
+  std::string html(m_renderer.get_output());
+  for (const auto &part : m_parts)
+    html.append(part->html);
+  m_renderer.clear();
+  m_renderer.end_page();
+  html.append(m_renderer.get_output());
+  return html;
+}
+
+bool EditableDocument::render(OutputSink &output) {
+  m_renderer.set_sink(&output);
+  m_renderer.clear();
+  m_renderer.begin_page();
+  bool written = m_renderer.flush();
+
+  for (size_t index = 0; written && index < m_parts.size(); ++index) {
+    const std::string &html = m_parts[index]->html;
+    written = html.empty() || output.write(html);
+  }
+
+  if (written) {
+    m_renderer.end_page();
+    written = m_renderer.flush();
+  }
+  m_renderer.set_sink(nullptr);
+  return written;
+}
+
+size_t EditableDocument::part_count() const {
+  return m_parts.size();
+}
+
+const Document &EditableDocument::part(size_t index) const {
+  return m_parts[index]->document;
+}
+
+// Lexes, parses and renders the part, its tokens and tree viewing the
+// source it owns
+std::unique_ptr<EditableDocument::Part>
+EditableDocument::parse_part(std::string source) {
+  auto part = std::make_unique<Part>();
+  part->source = std::move(source);
+
+  m_lexer.reset(part->source);
+  m_lexer.tokenize(part->tokens);
+
+  BlockParser parser(part->tokens);
+  parser.parse(part->document);
+  part->block_count = parser.block_starts().size();
+
+  const FlatDocument &flat = part->document.flat;
+  m_renderer.clear();
+  m_renderer.render_nodes(flat, 1, flat.size());
+  part->html = m_renderer.get_output();
+  return part;
+}
+
+size_t EditableDocument::replace_parts(size_t first, size_t last,
+                                       std::string_view text) {
+  std::vector<std::unique_ptr<Part>> parts;
+  size_t part_begin = 0;
+  for (size_t point : SplitScanner::split_points(text, m_part_size)) {
+    parts.push_back(
+        parse_part(std::string(text.substr(part_begin, point - part_begin))));
+    part_begin = point;
+  }
+  if (part_begin < text.size())
+    parts.push_back(parse_part(std::string(text.substr(part_begin))));
+
+  size_t added_count = parts.size();
+  m_parts.erase(m_parts.begin() + first, m_parts.begin() + last);
+  m_parts.insert(m_parts.begin() + first,
+                 std::make_move_iterator(parts.begin()),
+                 std::make_move_iterator(parts.end()));
+
+  m_part_offsets.resize(m_parts.size() + 1);
+  for (size_t index = first; index < m_parts.size(); ++index)
+    m_part_offsets[index + 1] =
+        m_part_offsets[index] + m_parts[index]->source.size();
+  return added_count;
+}
+
+size_t EditableDocument::find_part(size_t offset) const {
+  if (m_parts.empty())
+    return 0;
+  auto next = std::upper_bound(m_part_offsets.begin(),
+                               m_part_offsets.end() - 1, offset);
+  return std::min<size_t>(next - m_part_offsets.begin() - 1,
+                          m_parts.size() - 1);
+}
+
+size_t EditableDocument::block_count(size_t first, size_t last) const {
+  size_t count = 0;
+  for (size_t index = first; index < last; ++index)
+    count += m_parts[index]->block_count;
+  return count;
+}
+
+} // namespace mt
@@ -0,0 +1,160 @@
+#include "file_watcher.hpp"
+
+#include <algorithm>
+#include <system_error>
+
+#ifdef __linux__
+#define MT_HAS_INOTIFY 1
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace mt {
+
+namespace fs = std::filesystem;
+
+#ifdef MT_HAS_INOTIFY
+
+// Files are changed once closed after writing or moved in, editors often
+// saving to a temporary file renamed over the old one
+static constexpr uint32_t watch_mask =
+    IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR;
+
+FileWatcher::FileWatcher()
+    : m_descriptor(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+      m_directories() {
+}
+
+FileWatcher::~FileWatcher() {
+  if (m_descriptor >= 0)
+    ::close(m_descriptor);
+}
+
+bool FileWatcher::watch(const fs::path &directory, bool recursive) {
+  return m_descriptor >= 0 && add_watch(directory, recursive);
+}
+
+bool FileWatcher::wait(std::vector<fs::path> &changed,
+                       std::chrono::milliseconds quiet_period) {
+  changed.clear();
+  if (m_descriptor < 0)
+    return false;
+
+  // Blocks until the first change, then until the writes stop
+  bool quiet = false;
+  while (changed.empty() || !quiet) {
+    pollfd descriptor{m_descriptor, POLLIN, 0};
+    int timeout = changed.empty() ? -1 : static_cast<int>(quiet_period.count());
+    int ready = poll(&descriptor, 1, timeout);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    quiet = ready == 0;
+    if (!quiet && !read_events(changed))
+      return false;
+  }
+
+  std::sort(changed.begin(), changed.end());
+  changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+  return true;
+}
+
+bool FileWatcher::add_watch(const fs::path &directory, bool recursive) {
+  int watch = inotify_add_watch(m_descriptor, directory.c_str(), watch_mask);
+  if (watch < 0)
+    return false;
+  m_directories[watch] = {directory, recursive};
+  if (!recursive)
+    return true;
+
+  std::error_code error;
+  fs::directory_iterator entries(
+      directory, fs::directory_options::skip_permission_denied, error);
+  for (; !error && entries != fs::directory_iterator();
+       entries.increment(error)) {
+    // Directories which vanish in the meantime aren't missed
+    if (entries->is_directory(error) && !entries->is_symlink(error))
+      add_watch(entries->path(), true);
+  }
+  return !error;
+}
+
+bool FileWatcher::read_events(std::vector<fs::path> &changed) {
+  alignas(inotify_event) char buffer[16 * 1024];
+
+  while (true) {
+    ssize_t length = ::read(m_descriptor, buffer, sizeof(buffer));
+    if (length < 0)
+      return errno == EAGAIN || errno == EINTR;
+
+    for (ssize_t offset = 0; offset < length;) {
+      const auto *event = reinterpret_cast<const inotify_event *>(buffer +
+                                                                  offset);
+      offset += sizeof(inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        for (const auto &[watch, directory] : m_directories)
+          changed.push_back(directory.path);
+        continue;
+      }
+
+      auto directory = m_directories.find(event->wd);
+      if (directory == m_directories.end())
+        continue;
+      if (event->mask & IN_IGNORED) {
+        m_directories.erase(directory);
+        continue;
+      }
+      if (event->len == 0)
+        continue;
+
+      fs::path path = directory->second.path / event->name;
+      if (event->mask & IN_ISDIR) {
+        // Files can be written into a new directory before it's watched
+        if (directory->second.recursive &&
+            (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+          add_watch(path, true);
+          changed.push_back(std::move(path));
+        }
+      } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        changed.push_back(std::move(path));
+      }
+    }
+  }
+}
+
+#else
+
+FileWatcher::FileWatcher()
+    : m_descriptor(-1),
+      m_directories() {
+}
+
+FileWatcher::~FileWatcher() = default;
+
+bool FileWatcher::watch(const fs::path &, bool) {
+  return false;
+}
+
+bool FileWatcher::wait(std::vector<fs::path> &changed,
+                       std::chrono::milliseconds) {
+  changed.clear();
+  return false;
+}
+
+bool FileWatcher::add_watch(const fs::path &, bool) {
+  return false;
+}
+
+bool FileWatcher::read_events(std::vector<fs::path> &) {
+  return false;
+}
+
+#endif
+
+} // namespace mt
@@ -0,0 +1,258 @@
+#include "flat_document.hpp"
+
+#include <limits>
+#include <string>
+
+#include "node.hpp"
+
+namespace mt {
+
+// Saved data: a header (the magic, the version, the record, string and
+// text sizes and flags, 0 so far), the records, the offset and size of
+// every string in the text, and the text. Numbers are little-endian
+static constexpr std::string_view format_magic = "MTAS";
+static constexpr size_t header_size = 24;
+static constexpr size_t record_size = 16;
+static constexpr size_t string_entry_size = 8;
+// Saved data is written out in parts of this size
+static constexpr size_t save_buffer_size = 64 * 1024;
+
+static void put_u32(std::string &buffer, uint32_t value) {
+  for (int shift = 0; shift < 32; shift += 8)
+    buffer.push_back(static_cast<char>(value >> shift));
+}
+
+static uint32_t get_u32(const char *data) {
+  uint32_t value = 0;
+  for (int index = 3; index >= 0; --index)
+    value = value << 8 | static_cast<unsigned char>(data[index]);
+  return value;
+}
+
+// Strings each kind of node is rendered with, at least
+static size_t min_string_count(NodeKind kind) {
+  switch (kind) {
+  case NodeKind::CODE_SPAN:
+  case NodeKind::TEXT:
+  case NodeKind::LINK:
+  case NodeKind::INLINE_CODE:
+    return 1;
+  case NodeKind::IMAGE:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+// Flattens the tree in preorder, iteratively, so deep trees don't recurse
+void FlatDocument::build(const Node &root) {
+  clear();
+
+  m_open.push_back({append(root), &root});
+  const Node *node = root.first_child;
+
+  while (!m_open.empty()) {
+    if (node) {
+      uint32_t index = append(*node);
+      if (node->first_child) {
+        m_open.push_back({index, node});
+        node = node->first_child;
+      } else {
+        node = node->next_sibling;
+      }
+      continue;
+    }
+
+    // The subtree is done, going on with the parent's next sibling
+    auto [index, parent] = m_open.back();
+    m_open.pop_back();
+    close(index);
+    node = parent == &root ? nullptr : parent->next_sibling;
+  }
+}
+
+void FlatDocument::clear() {
+  m_nodes.clear();
+  m_strings.clear();
+  m_open.clear();
+}
+
+bool FlatDocument::save(OutputSink &output) const {
+  size_t text_size = 0;
+  for (std::string_view string : m_strings)
+    text_size += string.size();
+  if (text_size > std::numeric_limits<uint32_t>::max())
+    return false;
+
+  std::string buffer;
+  buffer.reserve(save_buffer_size + record_size);
+  auto flush = [&output, &buffer]() {
+    bool written = buffer.empty() || output.write(buffer);
+    buffer.clear();
+    return written;
+  };
+
+  buffer.append(format_magic);
+  put_u32(buffer, format_version);
+  put_u32(buffer, static_cast<uint32_t>(m_nodes.size()));
+  put_u32(buffer, static_cast<uint32_t>(m_strings.size()));
+  put_u32(buffer, static_cast<uint32_t>(text_size));
+  put_u32(buffer, 0);
+
+  for (const FlatNode &node : m_nodes) {
+    buffer.push_back(static_cast<char>(node.kind));
+    buffer.push_back(static_cast<char>(node.heading_level));
+    buffer.append(2, '\0');
+    put_u32(buffer, node.subtree_size);
+    put_u32(buffer, node.first_string);
+    put_u32(buffer, node.string_count);
+    if (buffer.size() >= save_buffer_size && !flush())
+      return false;
+  }
+
+  uint32_t offset = 0;
+  for (std::string_view string : m_strings) {
+    put_u32(buffer, offset);
+    put_u32(buffer, static_cast<uint32_t>(string.size()));
+    offset += static_cast<uint32_t>(string.size());
+    if (buffer.size() >= save_buffer_size && !flush())
+      return false;
+  }
+
+  // Long strings go to the sink as they are
+  for (std::string_view string : m_strings) {
+    if (buffer.size() + string.size() > save_buffer_size) {
+      if (!flush())
+        return false;
+      if (string.size() > save_buffer_size) {
+        if (!output.write(string))
+          return false;
+        continue;
+      }
+    }
+    buffer.append(string);
+  }
+  return flush();
+}
+
+// Every record is checked, so that rendering the tree never reads past its
+// records or strings
+bool FlatDocument::load(std::string_view data) {
+  clear();
+  if (data.size() < header_size || !data.starts_with(format_magic) ||
+      get_u32(data.data() + 4) != format_version)
+    return false;
+
+  size_t node_count = get_u32(data.data() + 8);
+  size_t string_count = get_u32(data.data() + 12);
+  size_t text_size = get_u32(data.data() + 16);
+  size_t available = data.size() - header_size;
+  if (node_count == 0 || node_count > available / record_size)
+    return false;
+  available -= node_count * record_size;
+  if (string_count > available / string_entry_size)
+    return false;
+  available -= string_count * string_entry_size;
+  if (available != text_size)
+    return false;
+
+  size_t strings_offset = header_size + node_count * record_size;
+  size_t text_offset = strings_offset + string_count * string_entry_size;
+
+  m_strings.reserve(string_count);
+  std::string_view text = data.substr(text_offset);
+  for (size_t index = 0; index < string_count; ++index) {
+    const char *entry = data.data() + strings_offset +
+                        index * string_entry_size;
+    size_t offset = get_u32(entry);
+    size_t size = get_u32(entry + 4);
+    if (offset > text_size || size > text_size - offset) {
+      clear();
+      return false;
+    }
+    m_strings.push_back(text.substr(offset, size));
+  }
+
+  // Subtrees have to lie within the subtree of their parent, the open ones
+  // being tracked by their end
+  std::vector<size_t> subtree_ends;
+  m_nodes.reserve(node_count);
+  for (size_t index = 0; index < node_count; ++index) {
+    const char *record = data.data() + header_size + index * record_size;
+    FlatNode node{static_cast<NodeKind>(record[0]),
+                  static_cast<uint8_t>(record[1]), get_u32(record + 4),
+                  get_u32(record + 8), get_u32(record + 12)};
+
+    while (!subtree_ends.empty() && subtree_ends.back() <= index)
+      subtree_ends.pop_back();
+    size_t end = index + node.subtree_size;
+    size_t parent_end = subtree_ends.empty() ? node_count
+                                             : subtree_ends.back();
+    bool valid =
+        static_cast<unsigned char>(record[0]) < node_kind_count &&
+        node.subtree_size != 0 && end <= parent_end &&
+        (index != 0 || end == node_count) &&
+        node.first_string <= string_count &&
+        node.string_count <= string_count - node.first_string &&
+        node.string_count >= min_string_count(node.kind);
+    if (!valid) {
+      clear();
+      return false;
+    }
+
+    if (node.subtree_size > 1)
+      subtree_ends.push_back(end);
+    m_nodes.push_back(node);
+  }
+  return true;
+}
+
+size_t FlatDocument::children_end(size_t count) const {
+  size_t index = 1;
+  for (size_t child = 0; child < count && index < m_nodes.size(); ++child)
+    index += m_nodes[index].subtree_size;
+  return index;
+}
+
+uint32_t FlatDocument::append(const Node &node) {
+  FlatNode flat{node.kind, 0, 1, static_cast<uint32_t>(m_strings.size()), 0};
+
+  switch (node.kind) {
+  case NodeKind::HEADING:
+    flat.heading_level = static_cast<const Heading &>(node).heading_level;
+    break;
+  case NodeKind::CODE_SPAN: {
+    const auto &code_span = static_cast<const CodeSpan &>(node);
+    m_strings.push_back(code_span.language);
+    m_strings.insert(m_strings.end(), code_span.code.begin(),
+                     code_span.code.end());
+    break;
+  }
+  case NodeKind::TEXT:
+    m_strings.push_back(static_cast<const Text &>(node).text);
+    break;
+  case NodeKind::LINK:
+    m_strings.push_back(static_cast<const Link &>(node).url);
+    break;
+  case NodeKind::IMAGE:
+    m_strings.push_back(static_cast<const Image &>(node).url);
+    m_strings.push_back(static_cast<const Image &>(node).alt_text);
+    break;
+  case NodeKind::INLINE_CODE:
+    m_strings.push_back(static_cast<const InlineCode &>(node).code);
+    break;
+  default:
+    break;
+  }
+
+  flat.string_count =
+      static_cast<uint32_t>(m_strings.size()) - flat.first_string;
+  m_nodes.push_back(flat);
+  return static_cast<uint32_t>(m_nodes.size() - 1);
+}
+
+void FlatDocument::close(uint32_t index) {
+  m_nodes[index].subtree_size = static_cast<uint32_t>(m_nodes.size()) - index;
+}
+
+} // namespace mt
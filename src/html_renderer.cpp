@@ -1,10 +1,26 @@
 #include "html_renderer.hpp"
 #include "node.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <utility>
 
 namespace mt {
 
-static const std::string default_optional_style =
+static constexpr std::array<bool, 256> make_escaped_table() {
+  std::array<bool, 256> table{};
+  for (char c : std::string_view("&\"'<>\r"))
+    table[static_cast<unsigned char>(c)] = true;
+  return table;
+}
+
+static constexpr std::array<bool, 256> escaped_table = make_escaped_table();
+
+static bool is_escaped(char c) {
+  return escaped_table[static_cast<unsigned char>(c)];
+}
+
+static constexpr char default_optional_style[] =
     "body { "
     "  font-family: 'Times New Roman', serif; "
     "  background-color: #ffffff; "
@@ -34,161 +50,367 @@ static const std::string default_optional_style =
     "  padding: 0; "
     "}\n";
 
+// Joins string literals at compile time
+template <size_t... Sizes>
+static constexpr std::array<char, (Sizes + ...) - sizeof...(Sizes)>
+join(const char (&...parts)[Sizes]) {
+  std::array<char, (Sizes + ...) - sizeof...(Sizes)> joined{};
+  size_t offset = 0;
+  ((std::copy(parts, parts + Sizes - 1, joined.begin() + offset),
+    offset += Sizes - 1),
+   ...);
+  return joined;
+}
+
+template <size_t Size>
+static constexpr std::string_view view(const std::array<char, Size> &chars) {
+  return {chars.data(), Size};
+}
+
+static constexpr auto page_head = join("<!DOCTYPE html>\n<html>\n<head>\n"
+                                       "<meta charset=\"utf-8\">\n<title>");
+static constexpr auto styled_head_end =
+    join("</title>\n<style>\n", default_optional_style,
+         "</style>\n</head>\n<body>\n");
+static constexpr auto head_end = join("</title>\n</head>\n<body>\n");
+static constexpr auto styled_body_start =
+    join("<style>\n", default_optional_style, "</style>\n<body>\n");
+
+// The page around the blocks for a set of options, the title going
+// between the two parts of its start
+struct PageLayout {
+  std::string_view start;
+  bool has_title;
+  std::string_view title_end;
+  std::string_view end;
+};
+
+// By only_body * 2 + use_default_style
+static constexpr std::array<PageLayout, 4> page_layouts = {{
+    {view(page_head), true, view(head_end), "\n</body>\n</html>"},
+    {view(page_head), true, view(styled_head_end), "\n</body>\n</html>"},
+    {"", false, "<body>\n", "\n</body>\n"},
+    {"", false, view(styled_body_start), "\n</body>\n"},
+}};
+
+static constexpr std::array<std::string_view, 7> heading_open_tags = {
+    "<h0>", "<h1>", "<h2>", "<h3>", "<h4>", "<h5>", "<h6>"};
+static constexpr std::array<std::string_view, 7> heading_close_tags = {
+    "</h0>\n", "</h1>\n", "</h2>\n", "</h3>\n",
+    "</h4>\n", "</h5>\n", "</h6>\n"};
+
 HtmlRenderer::HtmlRenderer(std::string title, bool use_default_style,
                            bool only_body)
     : m_title(std::move(title)),
-      m_use_default_style(use_default_style),
-      m_only_body(only_body) {
+      m_layout(only_body * 2 + use_default_style),
+      m_classify_escaped(simd::escaped_char_classifier()) {
+}
+
+std::string_view HtmlRenderer::render(const Document &document) {
+  return render(flat_tree(document));
 }
 
-std::string HtmlRenderer::get_output() const {
-  std::stringstream html_output;
+std::string_view HtmlRenderer::render(const FlatDocument &document) {
+  clear();
+  begin_page();
+  flush();
+  render_nodes(document, 0, document.size());
+  end_page();
+  flush();
 
-  if (!m_only_body) {
+  return m_html;
+}
+
+void HtmlRenderer::begin_page() {
+  m_cleared_bytes = 0;
+  m_output_exhausted = m_sink_failed;
 
-    html_output << "<!DOCTYPE html>\n<html>\n<head>\n<meta "
-                   "charset=\"utf-8\">\n<title>";
-    html_output << m_title;
-    html_output << "</title>\n";
+  const PageLayout &layout = page_layouts[m_layout];
+  if (layout.has_title) {
+    m_html += layout.start;
+    m_html += m_title;
   }
+  m_html += layout.title_end;
+}
 
-  if (m_use_default_style) {
-    html_output << "<style>\n";
-    html_output << default_optional_style;
-    html_output << "</style>\n";
+void HtmlRenderer::render_block(const Node &node) {
+  m_flat.build(node);
+  render_nodes(m_flat, 0, m_flat.size());
+}
+
+void HtmlRenderer::render_blocks(const Document &document, size_t count) {
+  const FlatDocument &flat = flat_tree(document);
+  render_nodes(flat, 1, flat.children_end(count));
+}
+
+// Parsed documents come with their flat tree, others are flattened here
+const FlatDocument &HtmlRenderer::flat_tree(const Document &document) {
+  if (!document.flat.size() && document.first_child) {
+    m_flat.build(document);
+    return m_flat;
   }
+  return document.flat;
+}
 
-  if (!m_only_body)
-    html_output << "</head>\n";
+void HtmlRenderer::end_page() {
+  m_html += page_layouts[m_layout].end;
+}
 
-  html_output << "<body>\n";
-  html_output << m_html_body.str();
-  html_output << "\n</body>\n";
+void HtmlRenderer::begin_text_paragraph() {
+  m_text_paragraph_open = false;
+  if (m_output_exhausted)
+    return;
 
-  if (!m_only_body)
-    html_output << "</html>";
+  size_t node_begin = m_html.size();
+  m_html += "<p>";
+  m_text_paragraph_open = within_output_limit(node_begin);
+}
+
+// Like a text node, a part past the output limit is left out whole
+void HtmlRenderer::render_text(std::string_view text) {
+  if (!m_text_paragraph_open || m_output_exhausted)
+    return;
+  if (m_sink && m_html.size() >= m_flush_size && !flush())
+    return;
 
-  return html_output.str();
+  size_t node_begin = m_html.size();
+  escape_html(text);
+  within_output_limit(node_begin);
 }
 
-void HtmlRenderer::clear() {
-  m_html_body.clear();
+void HtmlRenderer::end_text_paragraph() {
+  if (m_text_paragraph_open)
+    m_html += "</p>\n";
+  m_text_paragraph_open = false;
 }
 
-// Prevents injecting HTML code/tags from
-// the Markdown file
-std::string HtmlRenderer::escape_html(const std::string_view data) {
-  std::string buffer;
-  buffer.reserve(data.size());
-  for (char c : data) {
-    switch (c) {
-    case '&':
-      buffer.append("&amp;");
-      break;
-    case '\"':
-      buffer.append("&quot;");
-      break;
-    case '\'':
-      buffer.append("&apos;");
-      break;
-    case '<':
-      buffer.append("&lt;");
-      break;
-    case '>':
-      buffer.append("&gt;");
-      break;
-    default:
-      buffer.push_back(c);
-      break;
-    }
-  }
-  return buffer;
+std::string_view HtmlRenderer::get_output() const {
+  return m_html;
 }
 
-// actual imp
-void HtmlRenderer::visit(const Document &node) {
-  for (const auto &child : node.children)
-    child->accept(*this);
+void HtmlRenderer::set_title(std::string title) {
+  m_title = std::move(title);
 }
 
-void HtmlRenderer::visit(const Paragraph &node) {
-  m_html_body << "<p>";
-  for (const auto &child : node.children)
-    child->accept(*this);
-  m_html_body << "</p>\n";
+// Keeps the buffer's capacity, so a reused renderer doesn't reallocate
+void HtmlRenderer::clear() {
+  m_cleared_bytes += m_html.size();
+  m_html.clear();
 }
 
-void HtmlRenderer::visit(const Heading &node) {
-  m_html_body << "<h" << (int)node.heading_level << ">";
-  for (const auto &child : node.children)
-    child->accept(*this);
-  m_html_body << "</h" << (int)node.heading_level << ">\n";
+void HtmlRenderer::set_sink(OutputSink *sink, size_t flush_size) {
+  m_sink = sink;
+  m_flush_size = flush_size;
+  m_sink_failed = false;
 }
 
-void HtmlRenderer::visit(const CodeSpan &node) {
-  m_html_body << "<pre><code";
-  if (!node.language.empty()) {
-    m_html_body << " class=\"language-" << escape_html(node.language) << "\"";
+bool HtmlRenderer::flush() {
+  if (!m_sink)
+    return true;
+  if (!m_sink_failed && !m_html.empty() && !m_sink->write(m_html)) {
+    m_sink_failed = true;
+    m_output_exhausted = true;
   }
-  m_html_body << ">";
-  for (const auto &token : node.tokens)
-    m_html_body << escape_html(token.literal);
-  m_html_body << "</code></pre>\n";
+  clear();
+  return !m_sink_failed;
 }
 
-void HtmlRenderer::visit(const Text &node) {
-  m_html_body << escape_html(node.text);
+size_t HtmlRenderer::page_size() const {
+  return m_cleared_bytes + m_html.size();
 }
 
-void HtmlRenderer::visit(const Emphasis &node) {
-  m_html_body << "<em>";
-  for (const auto &child : node.children)
-    child->accept(*this);
-  m_html_body << "</em>";
+void HtmlRenderer::set_budget(Budget *budget) {
+  m_budget = budget;
+  m_max_output_bytes = budget ? budget->limits().max_output_bytes : 0;
 }
 
-void HtmlRenderer::visit(const StrongEmphasis &node) {
-  m_html_body << "<strong>";
-  for (const auto &child : node.children)
-    child->accept(*this);
-  m_html_body << "</strong>";
+// Prevents injecting HTML code/tags from
+// the Markdown file. Runs of plain characters are found 64 bytes at a time
+// and appended whole
+void HtmlRenderer::escape_html(const std::string_view data) {
+  size_t run_start = 0;
+  size_t block_start = 0;
+
+  for (; m_classify_escaped && block_start + simd::block_size <= data.size();
+       block_start += simd::block_size) {
+    uint64_t mask = m_classify_escaped(data.data() + block_start);
+    while (mask != 0) {
+      size_t index = block_start + static_cast<size_t>(std::countr_zero(mask));
+      m_html.append(data.substr(run_start, index - run_start));
+      escape_char(data[index]);
+      run_start = index + 1;
+      mask &= mask - 1;
+    }
+  }
+
+  // The tail is shorter than a block, as are most texts (or it's all of
+  // the data without vector instructions)
+  for (size_t index = block_start; index < data.size(); ++index) {
+    if (!is_escaped(data[index]))
+      continue;
+    m_html.append(data.substr(run_start, index - run_start));
+    escape_char(data[index]);
+    run_start = index + 1;
+  }
+
+  m_html.append(data.substr(run_start));
 }
 
-void HtmlRenderer::visit(const Link &node) {
-  m_html_body << "<a href=\"" << escape_html(node.url) << "\">";
-  for (const auto &child : node.children)
-    child->accept(*this);
-  m_html_body << "</a>";
+void HtmlRenderer::escape_char(char c) {
+  switch (c) {
+  case '&':
+    m_html.append("&amp;");
+    break;
+  case '\"':
+    m_html.append("&quot;");
+    break;
+  case '\'':
+    m_html.append("&apos;");
+    break;
+  case '<':
+    m_html.append("&lt;");
+    break;
+  case '>':
+    m_html.append("&gt;");
+    break;
+  default:
+    // Like the lexer, carriage returns are not part of the content
+    break;
+  }
 }
 
-void HtmlRenderer::visit(const Image &node) {
-  m_html_body << "<img src=\"" << escape_html(node.url) << "\" alt=\""
-              << escape_html(node.alt_text) << "\" />";
+// Inlined into the walk, the only place calling them
+inline bool HtmlRenderer::enter(const FlatDocument &document,
+                                const FlatNode &node) {
+  if (m_sink && m_html.size() >= m_flush_size && !flush())
+    return false;
+
+  size_t node_begin = m_html.size();
+  // Text, by far the most common node, has no tags
+  if (node.kind == NodeKind::TEXT)
+    escape_html(document.strings(node)[0]);
+  else
+    open_tag(node, document.strings(node));
+
+  return within_output_limit(node_begin);
 }
 
-void HtmlRenderer::visit(const InlineCode &node) {
-  m_html_body << "<code>" << escape_html(node.code) << "</code>";
+// Drops what was rendered from node_begin on once it takes the page past
+// the output limit, leaving out everything that follows
+bool HtmlRenderer::within_output_limit(size_t node_begin) {
+  if (!m_max_output_bytes ||
+      m_cleared_bytes + m_html.size() <= m_max_output_bytes)
+    return true;
+
+  m_html.resize(node_begin);
+  m_output_exhausted = true;
+  m_budget->exceed(Status::OUTPUT_LIMIT);
+  return false;
 }
 
-void HtmlRenderer::visit(const List &node) {
-  m_html_body << "<ul>\n";
-  for (const auto &child : node.children)
-    child->accept(*this);
-  m_html_body << "</ul>\n";
+inline void HtmlRenderer::leave(const FlatDocument &,
+                                const FlatNode &node) {
+  if (node.kind != NodeKind::TEXT)
+    close_tag(node);
 }
 
-void HtmlRenderer::visit(const ListItem &node) {
-  m_html_body << "<li>";
-  for (const auto &child : node.children)
-    child->accept(*this);
-  m_html_body << "</li>\n";
+void HtmlRenderer::render_nodes(const FlatDocument &document, size_t begin,
+                                size_t end) {
+  if (!m_output_exhausted)
+    walk(document, begin, end);
 }
 
-void HtmlRenderer::visit(const BlockQuote &node) {
-  m_html_body << "<blockquote>\n";
-  for (const auto &child : node.children)
-    child->accept(*this);
-  m_html_body << "</blockquote>\n";
+// Leaves are rendered whole by their opening tag
+void HtmlRenderer::open_tag(const FlatNode &node,
+                            std::span<const std::string_view> strings) {
+  switch (node.kind) {
+  case NodeKind::DOCUMENT:
+    break;
+  case NodeKind::PARAGRAPH:
+    m_html += "<p>";
+    break;
+  case NodeKind::HEADING:
+    m_html += heading_open_tags[std::min<size_t>(node.heading_level, 6)];
+    break;
+  case NodeKind::CODE_SPAN:
+    m_html += "<pre><code";
+    if (!strings[0].empty()) {
+      m_html += " class=\"language-";
+      escape_html(strings[0]);
+      m_html += "\"";
+    }
+    m_html += ">";
+    for (std::string_view code : strings.subspan(1))
+      escape_html(code);
+    m_html += "</code></pre>\n";
+    break;
+  case NodeKind::TEXT:
+    escape_html(strings[0]);
+    break;
+  case NodeKind::EMPHASIS:
+    m_html += "<em>";
+    break;
+  case NodeKind::STRONG_EMPHASIS:
+    m_html += "<strong>";
+    break;
+  case NodeKind::LINK:
+    m_html += "<a href=\"";
+    escape_html(strings[0]);
+    m_html += "\">";
+    break;
+  case NodeKind::IMAGE:
+    m_html += "<img src=\"";
+    escape_html(strings[0]);
+    m_html += "\" alt=\"";
+    escape_html(strings[1]);
+    m_html += "\" />";
+    break;
+  case NodeKind::INLINE_CODE:
+    m_html += "<code>";
+    escape_html(strings[0]);
+    m_html += "</code>";
+    break;
+  case NodeKind::LIST:
+    m_html += "<ul>\n";
+    break;
+  case NodeKind::LIST_ITEM:
+    m_html += "<li>";
+    break;
+  case NodeKind::BLOCK_QUOTE:
+    m_html += "<blockquote>\n";
+    break;
+  }
+}
+
+void HtmlRenderer::close_tag(const FlatNode &node) {
+  switch (node.kind) {
+  case NodeKind::PARAGRAPH:
+    m_html += "</p>\n";
+    break;
+  case NodeKind::HEADING:
+    m_html += heading_close_tags[std::min<size_t>(node.heading_level, 6)];
+    break;
+  case NodeKind::EMPHASIS:
+    m_html += "</em>";
+    break;
+  case NodeKind::STRONG_EMPHASIS:
+    m_html += "</strong>";
+    break;
+  case NodeKind::LINK:
+    m_html += "</a>";
+    break;
+  case NodeKind::LIST:
+    m_html += "</ul>\n";
+    break;
+  case NodeKind::LIST_ITEM:
+    m_html += "</li>\n";
+    break;
+  case NodeKind::BLOCK_QUOTE:
+    m_html += "</blockquote>\n";
+    break;
+  default:
+    break;
+  }
 }
 
 } // namespace mt
\ No newline at end of file
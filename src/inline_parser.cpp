@@ -1,190 +1,293 @@
 #include "inline_parser.hpp"
 #include "token.hpp"
 
-#include <iterator>
-#include <memory>
+#include <cstring>
 #include <string>
+#include <utility>
 
 namespace mt {
 
-std::optional<size_t> InlineParser::find_next(std::span<const Token> tokens,
-                                              TokenType type,
-                                              size_t start_index) {
-  for (size_t seeker_index = start_index; seeker_index < tokens.size();
-       ++seeker_index) {
-    if (tokens[seeker_index].type == type)
-      return seeker_index;
-  }
-
-  return std::nullopt;
-}
-
-std::string InlineParser::extract_text(std::span<const Token> tokens,
-                                       size_t index_start, size_t index_end) {
-  std::string text;
+// Tokens parsed between two looks at the clock
+static constexpr size_t deadline_check_interval = 4096;
 
+// Most ranges are whole lines or parts of one, whose tokens follow each
+// other in the source, the text then being a view into it
+std::string_view InlineParser::extract_text(TokenRange tokens,
+                                            size_t index_start,
+                                            size_t index_end, Arena &arena) {
   if (index_end > tokens.size())
     index_end = tokens.size() - 1;
+  if (index_start >= index_end)
+    return {};
+
+  const TokenStream &stream = *tokens.stream;
+  size_t begin_offset = stream.offset(tokens.stream_index(index_start));
+  size_t end_offset = begin_offset;
+  size_t size = 0;
+  bool contiguous = true;
+  for (size_t index = index_start; index < index_end; ++index) {
+    size_t stream_index = tokens.stream_index(index);
+    contiguous = contiguous && stream.offset(stream_index) == end_offset;
+    end_offset = stream.offset(stream_index) + stream.length(stream_index);
+    size += stream.length(stream_index);
+  }
+
+  if (contiguous)
+    return stream.source().substr(begin_offset, size);
+  if (size == 0)
+    return {};
 
+  // Carriage returns or container markers split the tokens apart
+  auto *text = static_cast<char *>(arena.allocate(size, 1));
+  size_t position = 0;
   for (size_t index = index_start; index < index_end; ++index) {
-    text += tokens[index].literal;
+    std::string_view literal = tokens.literal(index);
+    std::memcpy(text + position, literal.data(), literal.size());
+    position += literal.size();
   }
 
-  return text;
+  return {text, size};
+}
+
+void InlineParser::parse(TokenRange tokens, Node &parent, Document &document) {
+  m_tokens = tokens;
+  m_document = &document;
+  m_text_begin = no_text;
+  m_depth = 0;
+
+  find_closers();
+  parse_range(0, tokens.size(), parent);
 }
 
-bool InlineParser::match(std::span<const Token> tokens, size_t index,
-                         TokenType type) {
-  return index < tokens.size() && tokens[index].type == type;
+void InlineParser::set_budget(Budget *budget) {
+  m_budget = budget;
+  m_tokens_until_check = deadline_check_interval;
+  m_stopped = false;
 }
 
-std::vector<std::unique_ptr<Node>>
-InlineParser::parse(std::span<const Token> tokens) {
-  std::vector<std::unique_ptr<Node>> nodes;
-  std::string text_buffer;
+// Walks the tokens backwards, so that the closers following a token are
+// known when reaching it
+void InlineParser::find_closers() {
+  auto size = static_cast<uint32_t>(m_tokens.size());
+  m_closers.resize(size);
+  m_next_star_runs.fill(size);
+  m_next_backtick_runs.fill(size);
+  if (!m_next_long_backtick_runs.empty())
+    m_next_long_backtick_runs.clear();
+
+  uint32_t next_bracket_close = size;
+  uint32_t next_parent_close = size;
+
+  for (uint32_t index = size; index-- > 0;) {
+    uint32_t &closer = m_closers[index];
+    closer = size;
+
+    switch (m_tokens.type(index)) {
+    case TokenType::SQR_BRACKET_OPEN:
+      closer = next_bracket_close;
+      break;
+    case TokenType::SQR_BRACKET_CLOSE:
+      next_bracket_close = index;
+      break;
+    case TokenType::PARENT_OPEN:
+      closer = next_parent_close;
+      break;
+    case TokenType::PARENT_CLOSE:
+      next_parent_close = index;
+      break;
+    case TokenType::STAR: {
+      size_t count = m_tokens.literal(index).size();
+      if (count < m_next_star_runs.size())
+        closer = std::exchange(m_next_star_runs[count], index);
+      break;
+    }
+    case TokenType::BACKTICK: {
+      size_t count = m_tokens.literal(index).size();
+      if (count < m_next_backtick_runs.size()) {
+        closer = std::exchange(m_next_backtick_runs[count], index);
+      } else {
+        auto [next, inserted] =
+            m_next_long_backtick_runs.try_emplace(count, index);
+        if (!inserted)
+          closer = std::exchange(next->second, index);
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+}
+
+// Parses the tokens [begin, end) of the range, whose nodes are appended to
+// the parent. Closers are only looked for up to the end, as the tokens
+// that follow belong to the parent's parent
+void InlineParser::parse_range(size_t begin, size_t end, Node &parent) {
+  Arena &arena = m_document->arena;
 
-  auto construct_text_node = [&]() {
-    if (!text_buffer.empty()) {
-      nodes.push_back(std::make_unique<Text>(text_buffer));
-      text_buffer.clear();
+  for (size_t index = begin; index < end; ++index) {
+    if (m_budget && check_deadline()) {
+      add_to_text(index);
+      continue;
     }
-  };
 
-  for (size_t index = 0; index < tokens.size(); ++index) {
-    const Token &token = tokens[index];
+    TokenType type = m_tokens.type(index);
 
     // Inline Code: `...`
-    if (token.type == TokenType::BACKTICK) {
-      // Searching for the closing ` char
-      if (auto try_close = find_next(tokens, TokenType::BACKTICK, index + 1)) {
-        size_t closing_index = try_close.value();
-        construct_text_node();
+    if (type == TokenType::BACKTICK) {
+      // The next run of as many ` chars closes it
+      size_t closing_index = m_closers[index];
+      if (closing_index < end) {
+        add_text_node(parent, index);
 
-        std::string contents = extract_text(tokens, index + 1, closing_index);
+        std::string_view contents =
+            extract_text(m_tokens, index + 1, closing_index, arena);
 
-        nodes.push_back(std::make_unique<InlineCode>(contents));
+        m_document->add<InlineCode>(parent, contents);
         index = closing_index;
         continue;
       }
     }
 
     // Image: ![alt](url)
-    if (token.type == TokenType::BANG &&
-        match(tokens, index + 1, TokenType::SQR_BRACKET_OPEN)) {
-
-      if (auto try_close =
-              find_next(tokens, TokenType::SQR_BRACKET_CLOSE, index + 2)) {
-        size_t sqr_bracket_close_index = try_close.value();
-
-        if (match(
-                tokens, sqr_bracket_close_index + 1, TokenType::PARENT_OPEN)) {
-          if (auto try_close = find_next(tokens,
-                                         TokenType::PARENT_CLOSE,
-                                         sqr_bracket_close_index + 2)) {
-            size_t parent_close_index = try_close.value();
-
-            construct_text_node();
-
-            std::string alt =
-                extract_text(tokens, index + 2, sqr_bracket_close_index);
-            std::string url = extract_text(
-                tokens, sqr_bracket_close_index + 2, parent_close_index);
-
-            nodes.push_back(std::make_unique<Image>(url, alt));
-            index = parent_close_index;
-
-            continue;
-          }
+    if (type == TokenType::BANG &&
+        match(index + 1, end, TokenType::SQR_BRACKET_OPEN)) {
+      size_t sqr_bracket_close_index = m_closers[index + 1];
+
+      if (sqr_bracket_close_index < end &&
+          match(sqr_bracket_close_index + 1, end, TokenType::PARENT_OPEN)) {
+        size_t parent_close_index =
+            m_closers[sqr_bracket_close_index + 1];
+
+        if (parent_close_index < end) {
+          add_text_node(parent, index);
+
+          std::string_view alt =
+              extract_text(m_tokens, index + 2, sqr_bracket_close_index, arena);
+          std::string_view url = extract_text(
+              m_tokens, sqr_bracket_close_index + 2, parent_close_index, arena);
+
+          m_document->add<Image>(parent, url, alt);
+          index = parent_close_index;
+          continue;
         }
       }
     }
 
     // Link: [text](url)
-    if (token.type == TokenType::SQR_BRACKET_OPEN) {
-      if (auto try_close =
-              find_next(tokens, TokenType::SQR_BRACKET_CLOSE, index + 1)) {
-        size_t sqr_bracket_close_index = try_close.value();
-
-        if (match(
-                tokens, sqr_bracket_close_index + 1, TokenType::PARENT_OPEN)) {
-          if (auto try_close = find_next(tokens,
-                                         TokenType::PARENT_CLOSE,
-                                         sqr_bracket_close_index + 2)) {
-            size_t parent_close_index = try_close.value();
-
-            construct_text_node();
-
-            std::string url = extract_text(
-                tokens, sqr_bracket_close_index + 2, parent_close_index);
-
-            auto link = std::make_unique<Link>(url);
-            if (sqr_bracket_close_index > index + 1) {
-              // Recursive parsing of the link text
-              link->children = parse(tokens.subspan(
-                  index + 1, sqr_bracket_close_index - (index + 1)));
-            }
-
-            nodes.push_back(std::move(link));
-            index = parent_close_index;
-            continue;
-          }
+    if (type == TokenType::SQR_BRACKET_OPEN) {
+      size_t sqr_bracket_close_index = m_closers[index];
+
+      if (sqr_bracket_close_index < end &&
+          match(sqr_bracket_close_index + 1, end, TokenType::PARENT_OPEN)) {
+        size_t parent_close_index =
+            m_closers[sqr_bracket_close_index + 1];
+
+        if (parent_close_index < end && can_nest()) {
+          add_text_node(parent, index);
+
+          std::string_view url = extract_text(
+              m_tokens, sqr_bracket_close_index + 2, parent_close_index, arena);
+
+          uint32_t record = static_cast<uint32_t>(m_document->flat.size());
+          auto *link = m_document->add<Link>(parent, url);
+          // Recursive parsing of the link text
+          m_depth++;
+          parse_range(index + 1, sqr_bracket_close_index, *link);
+          m_depth--;
+          m_document->flat.close(record);
+
+          index = parent_close_index;
+          continue;
         }
       }
     }
 
-    // Emphasis and strong emphasis (* or **)
-    if (token.type == TokenType::STAR) {
-      bool strong_emphasis = match(tokens, index + 1, TokenType::STAR);
-      size_t delimiter_offset = strong_emphasis ? 2 : 1;
-
-      std::optional<size_t> end_index;
-      size_t seek_index = index + delimiter_offset;
-
-      while (auto try_close = find_next(tokens, TokenType::STAR, seek_index)) {
-        size_t closing_index = try_close.value();
-        if (strong_emphasis) {
-          // Trying to find a matching pair of closing * chars
-          if (match(tokens, closing_index + 1, TokenType::STAR)) {
-            end_index = closing_index;
-            break;
-          }
-
-          seek_index = closing_index + 1;
+    // Emphasis and strong emphasis (*, ** or ***)
+    size_t count = m_tokens.literal(index).size();
+    if (type == TokenType::STAR && count <= 3) {
+      // The next run of as many * chars closes it, runs of other lengths
+      // end up parsed inside of the emphasis
+      size_t closing_index = m_closers[index];
+      if (closing_index < end && can_nest()) {
+        add_text_node(parent, index);
+
+        // Emphasis node, *** being a strong emphasis inside of an emphasis
+        uint32_t record = static_cast<uint32_t>(m_document->flat.size());
+        Node *emphasis;
+        if (count == 1) {
+          emphasis = m_document->add<Emphasis>(parent);
+        } else if (count == 2) {
+          emphasis = m_document->add<StrongEmphasis>(parent);
         } else {
-          end_index = closing_index;
-          break;
+          Node *outer_emphasis = m_document->add<Emphasis>(parent);
+          emphasis = m_document->add<StrongEmphasis>(*outer_emphasis);
         }
-      }
-      if (end_index) {
-        size_t closing_index = end_index.value();
-        construct_text_node();
-
-        auto inner_span =
-            tokens.subspan(index + delimiter_offset,
-                           closing_index - (index + delimiter_offset));
 
-        // Emphasis node
-        std::unique_ptr<Node> emphasis;
-        if (strong_emphasis)
-          emphasis = std::make_unique<StrongEmphasis>();
-        else
-          emphasis = std::make_unique<Emphasis>();
+        m_depth++;
+        parse_range(index + 1, closing_index, *emphasis);
+        m_depth--;
 
-        emphasis->children = parse(inner_span);
-        nodes.push_back(std::move(emphasis));
+        if (count == 3)
+          m_document->flat.close(record + 1);
+        m_document->flat.close(record);
 
-        index = closing_index + (strong_emphasis ? 1 : 0);
+        index = closing_index;
         continue;
       }
     }
 
     // If not parsed as anything special
     // it's assumed it's a text node
-    text_buffer += token.literal;
+    add_to_text(index);
   }
 
-  construct_text_node();
+  add_text_node(parent, end);
+}
+
+void InlineParser::add_to_text(size_t index) {
+  if (m_text_begin == no_text)
+    m_text_begin = index;
+}
+
+// Turns the text gathered up to the given index into a node. Text is
+// always added before nested nodes are parsed, so it's only ever gathered
+// for the innermost one, and its tokens follow each other
+void InlineParser::add_text_node(Node &parent, size_t end) {
+  if (m_text_begin == no_text)
+    return;
+
+  std::string_view text =
+      extract_text(m_tokens, m_text_begin, end, m_document->arena);
+  if (!text.empty())
+    m_document->add<Text>(parent, text);
+  m_text_begin = no_text;
+}
+
+bool InlineParser::match(size_t index, size_t end, TokenType type) const {
+  return index < end && m_tokens.type(index) == type;
+}
+
+// Whether another element can be nested within the depth limit, openers
+// past it being text
+bool InlineParser::can_nest() {
+  if (!m_budget || !m_budget->limits().max_depth ||
+      m_depth < m_budget->limits().max_depth)
+    return true;
+
+  m_budget->exceed(Status::DEPTH_LIMIT);
+  return false;
+}
+
+// Whether the deadline passed, only looking at the clock now and then
+bool InlineParser::check_deadline() {
+  if (m_stopped)
+    return true;
+  if (--m_tokens_until_check > 0)
+    return false;
 
-  return nodes;
+  m_tokens_until_check = deadline_check_interval;
+  m_stopped = m_budget->expired();
+  return m_stopped;
 }
 } // namespace mt
@@ -0,0 +1,146 @@
+#include "input_file.hpp"
+
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MT_HAS_MMAP 1
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+
+namespace mt {
+
+InputFile::~InputFile() {
+  close();
+}
+
+InputFile::InputFile(InputFile &&other) noexcept
+    : m_mapping(std::exchange(other.m_mapping, nullptr)),
+      m_mapping_size(std::exchange(other.m_mapping_size, 0)),
+      m_buffer(std::move(other.m_buffer)) {
+}
+
+InputFile &InputFile::operator=(InputFile &&other) noexcept {
+  if (this != &other) {
+    close();
+    m_mapping = std::exchange(other.m_mapping, nullptr);
+    m_mapping_size = std::exchange(other.m_mapping_size, 0);
+    m_buffer = std::move(other.m_buffer);
+  }
+  return *this;
+}
+
+#ifdef MT_HAS_MMAP
+
+bool InputFile::open(const std::string &path) {
+  close();
+
+  int descriptor = ::open(path.c_str(), O_RDONLY);
+  if (descriptor < 0)
+    return false;
+
+  struct stat status{};
+  if (fstat(descriptor, &status) != 0) {
+    ::close(descriptor);
+    return false;
+  }
+
+  bool success = false;
+  if (S_ISREG(status.st_mode) && status.st_size > 0) {
+    size_t size = static_cast<size_t>(status.st_size);
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+    if (mapping != MAP_FAILED) {
+      // Tokens are slices of the source, so it's only ever read front to back
+      madvise(mapping, size, MADV_SEQUENTIAL);
+      m_mapping = static_cast<const char *>(mapping);
+      m_mapping_size = size;
+      success = true;
+    } else {
+      success = read_whole(descriptor, size);
+    }
+  } else {
+    // Pipes and special files don't know their size up front
+    success = read_whole(descriptor, 0);
+  }
+
+  ::close(descriptor);
+  return success;
+}
+
+void InputFile::close() {
+  if (m_mapping)
+    munmap(const_cast<char *>(m_mapping), m_mapping_size);
+
+  m_mapping = nullptr;
+  m_mapping_size = 0;
+  m_buffer.clear();
+}
+
+bool InputFile::read_whole(int descriptor, size_t size_hint) {
+  m_buffer.resize(size_hint > 0 ? size_hint : 64 * 1024);
+
+  size_t filled = 0;
+  while (true) {
+    if (filled == m_buffer.size())
+      m_buffer.resize(m_buffer.size() * 2);
+
+    ssize_t read_count =
+        ::read(descriptor, m_buffer.data() + filled, m_buffer.size() - filled);
+    if (read_count < 0) {
+      if (errno == EINTR)
+        continue;
+      m_buffer.clear();
+      return false;
+    }
+    if (read_count == 0)
+      break;
+
+    filled += static_cast<size_t>(read_count);
+  }
+
+  m_buffer.resize(filled);
+  return true;
+}
+
+#else
+
+bool InputFile::open(const std::string &path) {
+  close();
+
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file.is_open())
+    return false;
+
+  std::streamoff size = file.tellg();
+  if (size < 0)
+    return false;
+
+  m_buffer.resize(static_cast<size_t>(size));
+  file.seekg(0);
+  file.read(m_buffer.data(), size);
+  return static_cast<bool>(file) || file.eof();
+}
+
+void InputFile::close() {
+  m_buffer.clear();
+}
+
+#endif
+
+std::string_view InputFile::contents() const {
+  if (m_mapping)
+    return std::string_view(m_mapping, m_mapping_size);
+  return m_buffer;
+}
+
+bool InputFile::is_mapped() const {
+  return m_mapping != nullptr;
+}
+
+} // namespace mt
@@ -1,20 +1,40 @@
 #include "lexer.hpp"
 
+#include <bit>
+
 namespace mt {
 
 Lexer::Lexer(std::string_view source)
     : m_source(source),
-      m_tokens(),
+      m_tokens(nullptr),
       m_index(0),
-      m_line(1) {
+      m_block_start(std::string_view::npos),
+      m_block_mask(0),
+      m_classify(simd::special_char_classifier()) {
+}
+
+void Lexer::reset(std::string_view source) {
+  m_source = source;
+  m_index = 0;
 }
 
-std::vector<Token> Lexer::tokenize() {
-  m_tokens.clear();
+TokenStream Lexer::tokenize() {
+  TokenStream tokens;
+  tokenize(tokens);
+  return tokens;
+}
+
+void Lexer::tokenize(TokenStream &tokens) {
+  tokens.reset(m_source);
+  if (m_source.size() > TokenStream::max_source_size)
+    return;
+
+  m_tokens = &tokens;
   m_index = 0;
-  m_line = 1;
+  m_block_start = std::string_view::npos;
+  m_block_mask = 0;
 
-  add_token(TokenType::START_OF_FILE, "", m_line);
+  add_token(TokenType::START_OF_FILE, 0);
 
   while (!at_eof()) {
     char character = m_source[m_index];
@@ -27,58 +47,52 @@ std::vector<Token> Lexer::tokenize() {
 
     switch (character) {
     case ' ':
-      add_token(TokenType::SPACE, " ", m_line);
+      add_run_token(TokenType::SPACE, character);
       break;
     case '\n':
-      add_token(TokenType::NEW_LINE, "\n", m_line++);
+      add_token(TokenType::NEW_LINE, 1);
       break;
     case '\t':
-      add_token(TokenType::TAB, "\t", m_line);
+      add_run_token(TokenType::TAB, character);
       break;
     case '#':
-      add_token(TokenType::HASH, "#", m_line);
+      add_run_token(TokenType::HASH, character);
       break;
     case '!':
-      add_token(TokenType::BANG, "!", m_line);
+      add_token(TokenType::BANG, 1);
       break;
     case '-':
-      add_token(TokenType::HYPHEN, "-", m_line);
+      add_run_token(TokenType::HYPHEN, character);
       break;
     case '`':
-      add_token(TokenType::BACKTICK, "`", m_line);
+      add_run_token(TokenType::BACKTICK, character);
       break;
     case '*':
-      add_token(TokenType::STAR, "*", m_line);
+      add_run_token(TokenType::STAR, character);
       break;
     case '>':
-      add_token(TokenType::GREATER_THAN, ">", m_line);
+      add_token(TokenType::GREATER_THAN, 1);
       break;
     case '\\':
-      add_token(TokenType::BACKSLASH, "\\", m_line);
+      add_token(TokenType::BACKSLASH, 1);
       break;
     case '(':
-      add_token(TokenType::PARENT_OPEN, "(", m_line);
+      add_token(TokenType::PARENT_OPEN, 1);
       break;
     case ')':
-      add_token(TokenType::PARENT_CLOSE, ")", m_line);
+      add_token(TokenType::PARENT_CLOSE, 1);
       break;
     case '[':
-      add_token(TokenType::SQR_BRACKET_OPEN, "[", m_line);
+      add_token(TokenType::SQR_BRACKET_OPEN, 1);
       break;
     case ']':
-      add_token(TokenType::SQR_BRACKET_CLOSE, "]", m_line);
+      add_token(TokenType::SQR_BRACKET_CLOSE, 1);
       break;
 
     default: {
-      auto find_special_char = find_next_special();
-      size_t special_char_index = find_special_char.value_or(m_source.size());
+      size_t special_char_index = find_next_special(seeker_index + 1);
 
-      if (special_char_index <= seeker_index)
-        special_char_index = seeker_index + 1;
-
-      std::string_view text =
-          m_source.substr(seeker_index, special_char_index - seeker_index);
-      add_token(TokenType::TEXT, text, m_line);
+      add_token(TokenType::TEXT, special_char_index - seeker_index);
 
       m_index = special_char_index - 1;
       break;
@@ -88,27 +102,56 @@ std::vector<Token> Lexer::tokenize() {
     m_index++;
   }
 
-  add_token(TokenType::END_OF_FILE, "", m_line);
-  return m_tokens;
+  add_token(TokenType::END_OF_FILE, 0);
+  m_tokens = nullptr;
+}
+
+// Adds a token starting at the current index
+void Lexer::add_token(TokenType type, size_t length) {
+  m_tokens->push(type, m_index, length);
 }
 
-void Lexer::add_token(TokenType type, std::string_view literal, size_t line) {
-  m_tokens.push_back(Token{type, literal, line});
+// Coalesces a run of the same character into a single token, leaving
+// m_index at the run's last character
+void Lexer::add_run_token(TokenType type, char character) {
+  size_t run_end = m_index + 1;
+  while (run_end < m_source.size() && m_source[run_end] == character)
+    run_end++;
+
+  add_token(type, run_end - m_index);
+  m_index = run_end - 1;
 }
 
 bool Lexer::at_eof() const {
   return m_index >= m_source.size();
 }
 
-std::optional<size_t> Lexer::find_next_special() const {
-  static constexpr std::string_view special_chars = "\n\r#!-`*>()[\\\\]";
+// Scans through the special character bitmasks of 64 byte blocks, instead of
+// testing the bytes of TEXT tokens one by one
+size_t Lexer::find_next_special(size_t from) {
+  while (from < m_source.size()) {
+    size_t block_start = from - from % simd::block_size;
+
+    if (block_start != m_block_start) {
+      m_block_start = block_start;
+      if (block_start + simd::block_size <= m_source.size()) {
+        m_block_mask = m_classify(m_source.data() + block_start);
+      } else {
+        // The last block is padded with zeroes, which aren't special
+        char padded_block[simd::block_size] = {};
+        m_source.copy(padded_block, simd::block_size, block_start);
+        m_block_mask = m_classify(padded_block);
+      }
+    }
 
-  size_t find = m_source.find_first_of(special_chars, m_index);
+    uint64_t mask = m_block_mask >> (from - block_start);
+    if (mask != 0)
+      return from + static_cast<size_t>(std::countr_zero(mask));
 
-  if (find == std::string_view::npos)
-    return std::nullopt;
+    from = block_start + simd::block_size;
+  }
 
-  return find;
+  return m_source.size();
 }
 
 } // namespace mt
@@ -0,0 +1,110 @@
+#include "output_sink.hpp"
+
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MT_HAS_POSIX_IO 1
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace mt {
+
+bool BufferSink::write(std::string_view data) {
+  m_buffer += data;
+  return true;
+}
+
+std::string_view BufferSink::view() const {
+  return m_buffer;
+}
+
+void BufferSink::clear() {
+  m_buffer.clear();
+}
+
+FileSink::FileSink(int descriptor)
+    : m_descriptor(descriptor),
+      m_owned(false) {
+}
+
+FileSink::~FileSink() {
+  close();
+}
+
+#ifdef MT_HAS_POSIX_IO
+
+bool FileSink::open(const std::string &path) {
+  close();
+  m_descriptor = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  m_written_bytes = 0;
+  m_owned = m_descriptor >= 0;
+  return m_owned;
+}
+
+void FileSink::close() {
+  if (m_owned)
+    ::close(m_descriptor);
+  m_descriptor = -1;
+  m_owned = false;
+}
+
+// Writes can be cut short by signals or be partial, which just go on
+bool FileSink::write(std::string_view data) {
+  if (m_descriptor < 0)
+    return false;
+
+  while (!data.empty()) {
+    ssize_t written = ::write(m_descriptor, data.data(), data.size());
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data.remove_prefix(static_cast<size_t>(written));
+    m_written_bytes += static_cast<size_t>(written);
+  }
+  return true;
+}
+
+#else
+
+bool FileSink::open(const std::string &path) {
+  close();
+  m_file = std::fopen(path.c_str(), "wb");
+  m_written_bytes = 0;
+  if (m_file)
+    std::setvbuf(m_file, nullptr, _IONBF, 0);
+  return m_file != nullptr;
+}
+
+void FileSink::close() {
+  if (m_file)
+    std::fclose(m_file);
+  m_file = nullptr;
+}
+
+bool FileSink::write(std::string_view data) {
+  if (!m_file)
+    return false;
+  size_t written = std::fwrite(data.data(), 1, data.size(), m_file);
+  m_written_bytes += written;
+  return written == data.size();
+}
+
+#endif
+
+size_t FileSink::written_bytes() const {
+  return m_written_bytes;
+}
+
+CallbackSink::CallbackSink(Callback callback)
+    : m_callback(std::move(callback)) {
+}
+
+bool CallbackSink::write(std::string_view data) {
+  return m_callback(data);
+}
+
+} // namespace mt
@@ -0,0 +1,206 @@
+#include "parallel_transpiler.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <utility>
+
+#include "block_parser.hpp"
+
+namespace mt {
+
+// Parts per thread, so that threads given slower parts don't hold the
+// others up for long
+static constexpr size_t parts_per_thread = 4;
+// Parts rendered ahead of the writer, per thread
+static constexpr size_t parts_ahead_per_thread = 2;
+
+ParallelTranspiler::ParallelTranspiler(RenderOptions options,
+                                       size_t thread_count)
+    : m_context(options),
+      m_renderer(std::move(options.title),
+                 options.use_default_style,
+                 options.only_body),
+      m_serial(options.limits.any()),
+      m_thread_count(thread_count ? thread_count
+                                  : std::max(
+                                        std::thread::hardware_concurrency(),
+                                        1u)),
+      m_stats(nullptr),
+      m_workers(),
+      m_parts() {
+}
+
+bool ParallelTranspiler::transpile(std::string_view markdown,
+                                   OutputSink &output) {
+  std::vector<size_t> points;
+  if (!m_serial && m_thread_count > 1) {
+    size_t part_size = std::max(
+        min_part_size, markdown.size() / (m_thread_count * parts_per_thread));
+    points = SplitScanner::split_points(markdown, part_size);
+  }
+
+  if (points.empty())
+    return m_context.render(markdown, output);
+
+  m_parts.clear();
+  size_t begin = 0;
+  for (size_t point : points) {
+    m_parts.push_back({markdown.substr(begin, point - begin), {}, false});
+    begin = point;
+  }
+  m_parts.push_back({markdown.substr(begin), {}, false});
+
+  m_next_part = 0;
+  m_written_parts = 0;
+  m_stopping = false;
+
+  size_t thread_count = std::min(m_thread_count, m_parts.size());
+  while (m_workers.size() < thread_count)
+    m_workers.push_back(std::make_unique<Worker>());
+
+  std::vector<std::thread> threads;
+  for (size_t index = 0; index < thread_count; ++index) {
+    m_workers[index]->stats = TranspileStats();
+    threads.emplace_back(&ParallelTranspiler::work, this,
+                         std::ref(*m_workers[index]));
+  }
+
+  bool written = write_parts(output);
+  for (std::thread &thread : threads)
+    thread.join();
+
+  if (m_stats) {
+    for (size_t index = 0; index < thread_count; ++index)
+      m_stats->add(m_workers[index]->stats);
+    // Every part has its own start and end of file tokens and Document,
+    // but only one of each exists in the whole input
+    m_stats->token_counts[static_cast<size_t>(TokenType::START_OF_FILE)]++;
+    m_stats->token_counts[static_cast<size_t>(TokenType::END_OF_FILE)]++;
+    m_stats->node_counts[static_cast<size_t>(NodeKind::DOCUMENT)]++;
+    m_stats->input_bytes += markdown.size();
+  }
+
+  m_parts.clear();
+  return written;
+}
+
+void ParallelTranspiler::set_stats(TranspileStats *stats) {
+  m_stats = stats;
+  m_context.set_stats(stats);
+}
+
+Status ParallelTranspiler::status() const {
+  // Documents are only split without limits, which can't be hit then
+  return m_context.status();
+}
+
+size_t ParallelTranspiler::thread_count() const {
+  return m_thread_count;
+}
+
+// Takes the next part, as long as the writer isn't too far behind
+void ParallelTranspiler::work(Worker &worker) {
+  size_t parts_ahead = parts_ahead_per_thread * m_thread_count;
+
+  while (true) {
+    size_t index;
+    {
+      std::unique_lock lock(m_mutex);
+      m_part_written.wait(lock, [this, parts_ahead] {
+        return m_stopping || m_next_part >= m_parts.size() ||
+               m_next_part < m_written_parts + parts_ahead;
+      });
+      if (m_stopping || m_next_part >= m_parts.size())
+        return;
+      index = m_next_part++;
+    }
+
+    transpile_part(worker, m_parts[index]);
+
+    {
+      std::lock_guard lock(m_mutex);
+      m_parts[index].rendered = true;
+    }
+    m_part_rendered.notify_all();
+  }
+}
+
+// Renders the top-level blocks of the part, without the page around them
+void ParallelTranspiler::transpile_part(Worker &worker, Part &part) {
+  TranspileStats *stats = m_stats ? &worker.stats : nullptr;
+
+  {
+    StageTimer timer(stats ? &stats->lex : nullptr);
+    worker.lexer.reset(part.source);
+    worker.lexer.tokenize(worker.tokens);
+  }
+
+  {
+    StageTimer timer(stats ? &stats->parse : nullptr);
+    BlockParser parser(worker.tokens);
+    parser.parse(worker.document);
+  }
+
+  {
+    StageTimer timer(stats ? &stats->render : nullptr);
+    const FlatDocument &flat = worker.document.flat;
+    worker.renderer.clear();
+    worker.renderer.render_nodes(flat, 1, flat.size());
+    part.html = worker.renderer.get_output();
+  }
+
+  if (stats) {
+    stats->count_tokens(worker.tokens, 1, worker.tokens.size() - 1);
+    for (const Node &block : worker.document.children())
+      stats->count_nodes(block);
+  }
+}
+
+// Writes the page around the parts, each part as soon as it and the ones
+// before it are rendered
+bool ParallelTranspiler::write_parts(OutputSink &output) {
+  TimedSink timed_output(output, m_stats ? &m_stats->write : nullptr);
+  m_renderer.set_sink(&timed_output);
+  m_renderer.clear();
+  m_renderer.begin_page();
+  bool written = m_renderer.flush();
+  size_t parts_size = 0;
+
+  for (size_t index = 0; written && index < m_parts.size(); ++index) {
+    Part &part = m_parts[index];
+    {
+      std::unique_lock lock(m_mutex);
+      m_part_rendered.wait(lock, [&part] { return part.rendered; });
+    }
+
+    written = part.html.empty() || timed_output.write(part.html);
+    parts_size += part.html.size();
+    std::string().swap(part.html);
+
+    {
+      std::lock_guard lock(m_mutex);
+      m_written_parts = index + 1;
+    }
+    m_part_written.notify_all();
+  }
+
+  // Workers waiting to get ahead are let go, when the sink failed
+  {
+    std::lock_guard lock(m_mutex);
+    m_stopping = true;
+  }
+  m_part_written.notify_all();
+
+  if (written) {
+    m_renderer.end_page();
+    written = m_renderer.flush();
+  }
+  m_renderer.set_sink(nullptr);
+
+  if (m_stats)
+    m_stats->output_bytes += m_renderer.page_size() + parts_size;
+  return written;
+}
+
+} // namespace mt
@@ -0,0 +1,483 @@
+#include "render_server.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+#include "output_sink.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MT_HAS_UNIX_SOCKETS 1
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace mt {
+
+// Options byte or status byte, then a 4 byte length
+static constexpr size_t frame_header_size = 5;
+
+static size_t request_size(const unsigned char *header) {
+  return static_cast<size_t>(header[1]) << 24 |
+         static_cast<size_t>(header[2]) << 16 |
+         static_cast<size_t>(header[3]) << 8 | header[4];
+}
+
+RenderServer::RenderServer(Limits limits, size_t worker_count,
+                           size_t max_request_size)
+    : m_limits(limits),
+      m_worker_count(worker_count ? worker_count
+                                  : std::max(
+                                        std::thread::hardware_concurrency(),
+                                        1u)),
+      m_max_request_size(max_request_size),
+      m_workers(),
+      m_stopping(false),
+      m_listener(-1),
+      m_wake_input(-1),
+      m_wake_output(-1) {
+}
+
+RenderServer::~RenderServer() = default;
+
+void RenderServer::stop() {
+  m_stopping = true;
+#ifdef MT_HAS_UNIX_SOCKETS
+  // Wakes up the accepting thread
+  int listener = m_listener;
+  if (listener >= 0)
+    shutdown(listener, SHUT_RDWR);
+  wake();
+#endif
+}
+
+size_t RenderServer::worker_count() const {
+  return m_worker_count;
+}
+
+// Contexts are made on the first request with their options, their page
+// settings being fixed
+TranspileContext &RenderServer::context(Worker &worker, uint8_t options) {
+  std::unique_ptr<TranspileContext> &context = worker.contexts[options];
+  if (!context) {
+    bool only_body = options & only_body_option;
+    bool use_default_style = !only_body && !(options & no_styling_option);
+    context = std::make_unique<TranspileContext>(
+        RenderOptions{std::string(), use_default_style, only_body, m_limits});
+  }
+  return *context;
+}
+
+void RenderServer::report_error(std::string_view message) {
+  std::lock_guard lock(m_error_mutex);
+  std::cerr << "Error: " << message << "\n";
+}
+
+#ifdef MT_HAS_UNIX_SOCKETS
+
+// Reads until the buffer is full or the stream ends, returning false when
+// reading fails
+static bool read_bytes(int descriptor, char *data, size_t size,
+                       size_t &filled) {
+  filled = 0;
+  while (filled < size) {
+    ssize_t read_count = ::read(descriptor, data + filled, size - filled);
+    if (read_count < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (read_count == 0)
+      break;
+    filled += static_cast<size_t>(read_count);
+  }
+  return true;
+}
+
+static bool write_response(FileSink &output, uint8_t status,
+                           std::string_view html) {
+  uint32_t size = static_cast<uint32_t>(html.size());
+  char header[frame_header_size] = {static_cast<char>(status),
+                                    static_cast<char>(size >> 24),
+                                    static_cast<char>(size >> 16),
+                                    static_cast<char>(size >> 8),
+                                    static_cast<char>(size)};
+  return output.write(std::string_view(header, sizeof(header))) &&
+         (html.empty() || output.write(html));
+}
+
+bool RenderServer::serve_stream(int input, int output) {
+  // Writing to a reader which is gone fails instead of ending the process
+  std::signal(SIGPIPE, SIG_IGN);
+  if (m_workers.empty())
+    m_workers.push_back(std::make_unique<Worker>());
+  return serve_connection(*m_workers.front(), input, output);
+}
+
+bool RenderServer::serve_connection(Worker &worker, int input, int output) {
+  FileSink response(output);
+
+  while (true) {
+    unsigned char header[frame_header_size];
+    size_t filled = 0;
+    if (!read_bytes(input, reinterpret_cast<char *>(header), sizeof(header),
+                    filled)) {
+      report_error("Could not read request");
+      return false;
+    }
+    if (filled == 0)
+      return true;
+    if (filled < sizeof(header)) {
+      report_error("Truncated request");
+      return false;
+    }
+    if (!check_request(header, response))
+      return false;
+
+    size_t size = request_size(header);
+    worker.request.resize(size);
+    if (!read_bytes(input, worker.request.data(), size, filled) ||
+        filled < size) {
+      report_error("Truncated request");
+      return false;
+    }
+
+    if (!respond(worker, header[0], worker.request, response))
+      return false;
+  }
+}
+
+// Answers a malformed request with an error, returning false for it
+bool RenderServer::check_request(const unsigned char *header,
+                                 FileSink &response) {
+  uint8_t options = header[0];
+  size_t size = request_size(header);
+  if (options <= (only_body_option | no_styling_option) &&
+      size <= m_max_request_size)
+    return true;
+
+  report_error(size > m_max_request_size ? "Request too large"
+                                         : "Unknown request options");
+  write_response(response, request_error, {});
+  return false;
+}
+
+// Returns false when the response can't be written
+bool RenderServer::respond(Worker &worker, uint8_t options,
+                           std::string_view markdown, FileSink &response) {
+  TranspileContext &transpiler = context(worker, options);
+  std::string_view html = transpiler.render(markdown);
+  uint8_t status = static_cast<uint8_t>(transpiler.status());
+  if (html.size() > UINT32_MAX) {
+    report_error("Response too large");
+    html = {};
+    status = request_error;
+  }
+  if (!write_response(response, status, html)) {
+    report_error("Could not write response");
+    return false;
+  }
+  return true;
+}
+
+bool RenderServer::serve_socket(const std::string &path) {
+  std::signal(SIGPIPE, SIG_IGN);
+
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    report_error("Socket path too long: " + path);
+    return false;
+  }
+  path.copy(address.sun_path, path.size());
+  auto *socket_address = reinterpret_cast<sockaddr *>(&address);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    report_error("Could not create socket");
+    return false;
+  }
+
+  bool bound = bind(listener, socket_address, sizeof(address)) == 0;
+  if (!bound && errno == EADDRINUSE) {
+    // A socket nobody accepts on anymore is left by a server which is gone
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool in_use =
+        probe >= 0 && connect(probe, socket_address, sizeof(address)) == 0;
+    if (probe >= 0)
+      ::close(probe);
+    if (!in_use && unlink(path.c_str()) == 0)
+      bound = bind(listener, socket_address, sizeof(address)) == 0;
+  }
+  if (!bound || listen(listener, SOMAXCONN) != 0) {
+    report_error("Could not listen on socket: " + path);
+    ::close(listener);
+    return false;
+  }
+
+  int wake_pipe[2];
+  if (pipe(wake_pipe) != 0) {
+    report_error("Could not create pipe");
+    ::close(listener);
+    unlink(path.c_str());
+    return false;
+  }
+  fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+  m_wake_input = wake_pipe[0];
+  m_wake_output = wake_pipe[1];
+  m_requests_done = false;
+
+  m_listener = listener;
+  while (m_workers.size() < m_worker_count)
+    m_workers.push_back(std::make_unique<Worker>());
+  std::vector<std::thread> threads;
+  for (size_t index = 0; index < m_worker_count; ++index)
+    threads.emplace_back(&RenderServer::work, this,
+                         std::ref(*m_workers[index]));
+
+  bool accepted = serve_connections(listener);
+
+  {
+    std::lock_guard lock(m_mutex);
+    m_requests_done = true;
+  }
+  m_request_added.notify_all();
+  for (std::thread &thread : threads)
+    thread.join();
+
+  for (const auto &connection : m_connections)
+    ::close(connection->descriptor);
+  m_connections.clear();
+  m_requests.clear();
+  m_answered.clear();
+
+  m_listener = -1;
+  ::close(listener);
+  unlink(path.c_str());
+  m_wake_output = -1;
+  ::close(wake_pipe[1]);
+  ::close(wake_pipe[0]);
+  return accepted;
+}
+
+// Polls the listener and the connections which aren't being answered,
+// until stopped and every connection has ended. Returns false when
+// accepting connections fails
+bool RenderServer::serve_connections(int listener) {
+  std::vector<pollfd> polled;
+  std::vector<Connection *> polled_connections;
+  bool accepted = true;
+
+  while (!(m_stopping && m_connections.empty())) {
+    polled.clear();
+    polled_connections.clear();
+    // Stopping from another thread takes effect on the next round
+    bool listening = !m_stopping;
+    polled.push_back({m_wake_input, POLLIN, 0});
+    if (listening)
+      polled.push_back({listener, POLLIN, 0});
+    for (const auto &connection : m_connections) {
+      if (connection->busy)
+        continue;
+      polled.push_back({connection->descriptor, POLLIN, 0});
+      polled_connections.push_back(connection.get());
+    }
+
+    if (poll(polled.data(), polled.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      report_error("Could not poll connections");
+      return false;
+    }
+
+    // Connections answered by the workers are read again, or closed
+    if (polled[0].revents) {
+      char drained[64];
+      while (::read(m_wake_input, drained, sizeof(drained)) > 0) {
+      }
+
+      std::vector<Connection *> answered;
+      {
+        std::lock_guard lock(m_mutex);
+        answered.swap(m_answered);
+      }
+      for (Connection *connection : answered) {
+        connection->busy = false;
+        if (!connection->failed)
+          queue_request(*connection);
+      }
+    }
+
+    size_t first_connection = listening ? 2 : 1;
+    if (listening && polled[1].revents) {
+      int connection = accept(listener, nullptr, nullptr);
+      if (connection >= 0) {
+        auto added = std::make_unique<Connection>();
+        added->descriptor = connection;
+        m_connections.push_back(std::move(added));
+      } else if (!m_stopping && errno != EINTR && errno != ECONNABORTED) {
+        // Failures of a single connection don't stop the server
+        report_error("Could not accept connection");
+        accepted = false;
+        m_stopping = true;
+      }
+    }
+
+    for (size_t index = 0; index < polled_connections.size(); ++index) {
+      if (polled[first_connection + index].revents &&
+          !read_connection(*polled_connections[index]))
+        polled_connections[index]->failed = true;
+    }
+
+    // Connections which ended or failed are closed, unless being answered
+    std::erase_if(m_connections, [](const auto &connection) {
+      if (connection->busy || !connection->failed)
+        return false;
+      ::close(connection->descriptor);
+      return true;
+    });
+  }
+  return accepted;
+}
+
+// Reads what the connection holds without waiting for more, handing a
+// whole request to the workers. Returns false once the connection ended
+// or failed
+bool RenderServer::read_connection(Connection &connection) {
+  char buffer[64 * 1024];
+  ssize_t read_count =
+      recv(connection.descriptor, buffer, sizeof(buffer), MSG_DONTWAIT);
+  if (read_count < 0) {
+    if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+      return true;
+    report_error("Could not read request");
+    return false;
+  }
+  if (read_count == 0) {
+    if (!connection.input.empty())
+      report_error("Truncated request");
+    return false;
+  }
+
+  connection.input.append(buffer, static_cast<size_t>(read_count));
+  queue_request(connection);
+  return !connection.failed;
+}
+
+// Hands the connection to the workers once it holds a whole request. A
+// malformed one is answered right away and fails the connection
+void RenderServer::queue_request(Connection &connection) {
+  if (connection.input.size() < frame_header_size)
+    return;
+
+  const auto *header =
+      reinterpret_cast<const unsigned char *>(connection.input.data());
+  FileSink response(connection.descriptor);
+  if (!check_request(header, response)) {
+    connection.failed = true;
+    return;
+  }
+  if (connection.input.size() < frame_header_size + request_size(header))
+    return;
+
+  connection.busy = true;
+  {
+    std::lock_guard lock(m_mutex);
+    m_requests.push_back(&connection);
+  }
+  m_request_added.notify_one();
+}
+
+void RenderServer::wake() {
+  int output = m_wake_output;
+  if (output >= 0) {
+    char byte = 0;
+    [[maybe_unused]] ssize_t written = ::write(output, &byte, 1);
+  }
+}
+
+// Answers whole requests one at a time until the serving thread is done,
+// handing their connections back to it
+void RenderServer::work(Worker &worker) {
+  while (true) {
+    Connection *connection;
+    {
+      std::unique_lock lock(m_mutex);
+      m_request_added.wait(lock, [this] {
+        return m_requests_done || !m_requests.empty();
+      });
+      if (m_requests.empty())
+        return;
+      connection = m_requests.front();
+      m_requests.pop_front();
+    }
+
+    const auto *header =
+        reinterpret_cast<const unsigned char *>(connection->input.data());
+    size_t size = request_size(header);
+    FileSink response(connection->descriptor);
+    connection->failed = !respond(
+        worker, header[0],
+        std::string_view(connection->input).substr(frame_header_size, size),
+        response);
+    connection->input.erase(0, frame_header_size + size);
+
+    {
+      std::lock_guard lock(m_mutex);
+      m_answered.push_back(connection);
+    }
+    wake();
+  }
+}
+
+#else
+
+bool RenderServer::serve_stream(int, int) {
+  report_error("Serving requests needs POSIX descriptors");
+  return false;
+}
+
+bool RenderServer::serve_socket(const std::string &) {
+  report_error("Serving requests needs Unix domain sockets");
+  return false;
+}
+
+bool RenderServer::serve_connection(Worker &, int, int) {
+  return false;
+}
+
+bool RenderServer::check_request(const unsigned char *, FileSink &) {
+  return false;
+}
+
+bool RenderServer::respond(Worker &, uint8_t, std::string_view, FileSink &) {
+  return false;
+}
+
+bool RenderServer::serve_connections(int) {
+  return false;
+}
+
+bool RenderServer::read_connection(Connection &) {
+  return false;
+}
+
+void RenderServer::queue_request(Connection &) {
+}
+
+void RenderServer::wake() {
+}
+
+void RenderServer::work(Worker &) {
+}
+
+#endif
+
+} // namespace mt
@@ -0,0 +1,174 @@
+#include "simd.hpp"
+
+#include <array>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MT_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#define MT_TARGET_AVX2
+#else
+#define MT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace mt::simd {
+
+namespace {
+
+// A set of characters, with the tables the kernels look them up in
+struct CharSet {
+  std::array<bool, 256> table{};
+  // Nibble lookup: a byte is in the set when the classes of its low and
+  // high nibbles intersect. Every high nibble used gets its own class
+  // bit, so at most 8 of them can be
+  std::array<int8_t, 16> low_classes{};
+  std::array<int8_t, 16> high_classes{};
+  std::string_view chars;
+};
+
+constexpr CharSet make_char_set(std::string_view chars) {
+  CharSet set;
+  set.chars = chars;
+  uint8_t next_class = 1;
+  for (char c : chars) {
+    auto byte = static_cast<unsigned char>(c);
+    set.table[byte] = true;
+    if (set.high_classes[byte >> 4] == 0) {
+      set.high_classes[byte >> 4] = static_cast<int8_t>(next_class);
+      next_class <<= 1;
+    }
+    set.low_classes[byte & 0x0f] |= set.high_classes[byte >> 4];
+  }
+  return set;
+}
+
+// Has to stay in sync with the TEXT terminating characters of the Lexer
+constexpr CharSet lexer_chars = make_char_set("\n\r#!-`*>()[\\]");
+
+template <const CharSet &Set> uint64_t classify_scalar(const char *block) {
+  uint64_t mask = 0;
+  for (size_t i = 0; i < block_size; ++i) {
+    if (Set.table[static_cast<unsigned char>(block[i])])
+      mask |= uint64_t{1} << i;
+  }
+  return mask;
+}
+
+#ifdef MT_SIMD_X86
+
+// Characters HtmlRenderer escapes, or drops for \r
+constexpr CharSet escape_chars = make_char_set("&\"'<>\r");
+
+template <const CharSet &Set> uint64_t classify_sse2(const char *block) {
+  uint64_t mask = 0;
+  for (size_t offset = 0; offset < block_size; offset += 16) {
+    __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + offset));
+    __m128i hits = _mm_setzero_si128();
+    for (char c : Set.chars)
+      hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+    mask |= static_cast<uint64_t>(
+                static_cast<uint16_t>(_mm_movemask_epi8(hits)))
+            << offset;
+  }
+  return mask;
+}
+
+MT_TARGET_AVX2 __m256i load_nibble_table(const std::array<int8_t, 16> &table) {
+  __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&table));
+  return _mm256_broadcastsi128_si256(half);
+}
+
+template <const CharSet &Set>
+MT_TARGET_AVX2 uint64_t classify_avx2(const char *block) {
+  const __m256i low_table = load_nibble_table(Set.low_classes);
+  const __m256i high_table = load_nibble_table(Set.high_classes);
+  const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+
+  uint64_t mask = 0;
+  for (size_t offset = 0; offset < block_size; offset += 32) {
+    __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + offset));
+    __m256i low = _mm256_and_si256(bytes, nibble_mask);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble_mask);
+    __m256i classes =
+        _mm256_and_si256(_mm256_shuffle_epi8(low_table, low),
+                         _mm256_shuffle_epi8(high_table, high));
+    __m256i misses = _mm256_cmpeq_epi8(classes, _mm256_setzero_si256());
+    mask |= static_cast<uint64_t>(
+                ~static_cast<uint32_t>(_mm256_movemask_epi8(misses)))
+            << offset;
+  }
+  return mask;
+}
+
+bool cpu_has_avx2() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  __cpuid(info, 1);
+  // OSXSAVE and AVX, then the OS has to save the YMM registers
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+    return false;
+  if ((_xgetbv(0) & 0x6) != 0x6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+struct Dispatch {
+  ClassifyFunction classify_special;
+  // Escaping looks at the bytes one by one just as fast without vectors
+  ClassifyFunction classify_escaped;
+  std::string_view name;
+};
+
+// MT_SIMD=scalar or MT_SIMD=sse2 caps the picked variant, which is handy
+// for comparing them on one machine
+Dispatch pick_dispatch() {
+  const char *requested = std::getenv("MT_SIMD");
+  std::string_view cap = requested ? requested : "";
+  if (cap == "scalar")
+    return {classify_scalar<lexer_chars>, nullptr, "scalar"};
+#ifdef MT_SIMD_X86
+  if (cap != "sse2" && cpu_has_avx2())
+    return {classify_avx2<lexer_chars>, classify_avx2<escape_chars>, "avx2"};
+  return {classify_sse2<lexer_chars>, classify_sse2<escape_chars>, "sse2"};
+#else
+  return {classify_scalar<lexer_chars>, nullptr, "scalar"};
+#endif
+}
+
+const Dispatch &dispatch() {
+  static const Dispatch picked = pick_dispatch();
+  return picked;
+}
+
+} // namespace
+
+ClassifyFunction special_char_classifier() {
+  return dispatch().classify_special;
+}
+
+ClassifyFunction escaped_char_classifier() {
+  return dispatch().classify_escaped;
+}
+
+std::string_view active_instruction_set() {
+  return dispatch().name;
+}
+
+} // namespace mt::simd
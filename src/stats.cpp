@@ -0,0 +1,249 @@
+#include "stats.hpp"
+
+#include <atomic>
+#include <sstream>
+
+namespace mt {
+
+namespace allocation_counter {
+
+static std::atomic<bool> g_enabled{false};
+// Per thread, so that the stages of threads running at once aren't mixed up
+static thread_local size_t t_count = 0;
+static thread_local size_t t_bytes = 0;
+
+Snapshot snapshot() {
+  return Snapshot{t_count, t_bytes};
+}
+
+bool enabled() {
+  return g_enabled.load(std::memory_order_relaxed);
+}
+
+void enable() {
+  g_enabled.store(true, std::memory_order_relaxed);
+}
+
+void record(size_t bytes) {
+  t_count++;
+  t_bytes += bytes;
+}
+
+} // namespace allocation_counter
+
+void TranspileStats::add(const TranspileStats &other) {
+  StageStats *stages[] = {&read, &lex, &parse, &render, &write};
+  const StageStats *other_stages[] = {&other.read, &other.lex, &other.parse,
+                                      &other.render, &other.write};
+  for (size_t i = 0; i < std::size(stages); ++i) {
+    stages[i]->seconds += other_stages[i]->seconds;
+    stages[i]->allocations += other_stages[i]->allocations;
+    stages[i]->allocated_bytes += other_stages[i]->allocated_bytes;
+  }
+
+  for (size_t type = 0; type < token_type_count; ++type)
+    token_counts[type] += other.token_counts[type];
+  for (size_t kind = 0; kind < node_kind_count; ++kind)
+    node_counts[kind] += other.node_counts[kind];
+  input_bytes += other.input_bytes;
+  output_bytes += other.output_bytes;
+}
+
+void TranspileStats::count_tokens(const TokenStream &tokens) {
+  count_tokens(tokens, 0, tokens.size());
+}
+
+void TranspileStats::count_tokens(const TokenStream &tokens, size_t begin,
+                                  size_t end) {
+  for (size_t index = begin; index < end; ++index)
+    token_counts[static_cast<size_t>(tokens.type(index))]++;
+}
+
+void TranspileStats::count_nodes(const Node &node) {
+  node_counts[static_cast<size_t>(node.kind)]++;
+  for (const Node &child : node.children())
+    count_nodes(child);
+}
+
+std::string TranspileStats::to_text() const {
+  std::ostringstream text;
+  const StageStats *stages[] = {&read, &lex, &parse, &render, &write};
+
+  text << "Stage timings:\n";
+  for (const auto *stage : stages) {
+    text << "  " << stage->name << ": " << stage->seconds * 1000.0 << " ms";
+    if (allocation_counter::enabled())
+      text << ", " << stage->allocations << " allocations ("
+           << stage->allocated_bytes << " bytes)";
+    text << '\n';
+  }
+
+  text << "Tokens:\n";
+  for (size_t type = 0; type < token_type_count; ++type) {
+    if (token_counts[type] != 0)
+      text << "  " << token_type_name(static_cast<TokenType>(type)) << ": "
+           << token_counts[type] << '\n';
+  }
+
+  text << "Nodes:\n";
+  for (size_t kind = 0; kind < node_kind_count; ++kind) {
+    if (node_counts[kind] != 0)
+      text << "  " << node_kind_name(static_cast<NodeKind>(kind)) << ": "
+           << node_counts[kind] << '\n';
+  }
+
+  text << "Input bytes: " << input_bytes << '\n';
+  text << "Output bytes: " << output_bytes << '\n';
+  return text.str();
+}
+
+std::string TranspileStats::to_json() const {
+  std::ostringstream json;
+  const StageStats *stages[] = {&read, &lex, &parse, &render, &write};
+
+  json << "{\"stages\": {";
+  for (size_t i = 0; i < std::size(stages); ++i) {
+    json << (i == 0 ? "" : ", ") << '"' << stages[i]->name
+         << "\": {\"seconds\": " << stages[i]->seconds;
+    if (allocation_counter::enabled())
+      json << ", \"allocations\": " << stages[i]->allocations
+           << ", \"allocated_bytes\": " << stages[i]->allocated_bytes;
+    json << '}';
+  }
+
+  json << "}, \"tokens\": {";
+  bool first = true;
+  for (size_t type = 0; type < token_type_count; ++type) {
+    json << (first ? "" : ", ") << '"'
+         << token_type_name(static_cast<TokenType>(type))
+         << "\": " << token_counts[type];
+    first = false;
+  }
+
+  json << "}, \"nodes\": {";
+  first = true;
+  for (size_t kind = 0; kind < node_kind_count; ++kind) {
+    json << (first ? "" : ", ") << '"'
+         << node_kind_name(static_cast<NodeKind>(kind))
+         << "\": " << node_counts[kind];
+    first = false;
+  }
+
+  json << "}, \"input_bytes\": " << input_bytes
+       << ", \"output_bytes\": " << output_bytes << "}\n";
+  return json.str();
+}
+
+StageTimer::StageTimer(StageStats *stage, const StageStats *nested)
+    : m_stage(stage),
+      m_nested(stage ? nested : nullptr) {
+  if (m_nested)
+    m_nested_start = *m_nested;
+  if (m_stage) {
+    m_allocations = allocation_counter::snapshot();
+    m_start = std::chrono::steady_clock::now();
+  }
+}
+
+StageTimer::~StageTimer() {
+  if (!m_stage)
+    return;
+
+  auto end = std::chrono::steady_clock::now();
+  auto allocations = allocation_counter::snapshot();
+
+  m_stage->seconds += std::chrono::duration<double>(end - m_start).count();
+  m_stage->allocations += allocations.count - m_allocations.count;
+  m_stage->allocated_bytes += allocations.bytes - m_allocations.bytes;
+
+  if (m_nested) {
+    m_stage->seconds -= m_nested->seconds - m_nested_start.seconds;
+    m_stage->allocations -= m_nested->allocations - m_nested_start.allocations;
+    m_stage->allocated_bytes -=
+        m_nested->allocated_bytes - m_nested_start.allocated_bytes;
+  }
+}
+
+TimedSink::TimedSink(OutputSink &sink, StageStats *stage)
+    : m_sink(sink),
+      m_stage(stage) {
+}
+
+bool TimedSink::write(std::string_view data) {
+  StageTimer timer(m_stage);
+  return m_sink.write(data);
+}
+
+std::string_view token_type_name(TokenType type) {
+  switch (type) {
+  case TokenType::START_OF_FILE:
+    return "START_OF_FILE";
+  case TokenType::END_OF_FILE:
+    return "END_OF_FILE";
+  case TokenType::NEW_LINE:
+    return "NEW_LINE";
+  case TokenType::TAB:
+    return "TAB";
+  case TokenType::SPACE:
+    return "SPACE";
+  case TokenType::TEXT:
+    return "TEXT";
+  case TokenType::HASH:
+    return "HASH";
+  case TokenType::BANG:
+    return "BANG";
+  case TokenType::HYPHEN:
+    return "HYPHEN";
+  case TokenType::BACKTICK:
+    return "BACKTICK";
+  case TokenType::STAR:
+    return "STAR";
+  case TokenType::GREATER_THAN:
+    return "GREATER_THAN";
+  case TokenType::BACKSLASH:
+    return "BACKSLASH";
+  case TokenType::PARENT_OPEN:
+    return "PARENT_OPEN";
+  case TokenType::PARENT_CLOSE:
+    return "PARENT_CLOSE";
+  case TokenType::SQR_BRACKET_OPEN:
+    return "SQR_BRACKET_OPEN";
+  case TokenType::SQR_BRACKET_CLOSE:
+    return "SQR_BRACKET_CLOSE";
+  }
+  return "UNKNOWN";
+}
+
+std::string_view node_kind_name(NodeKind kind) {
+  switch (kind) {
+  case NodeKind::DOCUMENT:
+    return "Document";
+  case NodeKind::PARAGRAPH:
+    return "Paragraph";
+  case NodeKind::HEADING:
+    return "Heading";
+  case NodeKind::CODE_SPAN:
+    return "CodeSpan";
+  case NodeKind::TEXT:
+    return "Text";
+  case NodeKind::EMPHASIS:
+    return "Emphasis";
+  case NodeKind::STRONG_EMPHASIS:
+    return "StrongEmphasis";
+  case NodeKind::LINK:
+    return "Link";
+  case NodeKind::IMAGE:
+    return "Image";
+  case NodeKind::INLINE_CODE:
+    return "InlineCode";
+  case NodeKind::LIST:
+    return "List";
+  case NodeKind::LIST_ITEM:
+    return "ListItem";
+  case NodeKind::BLOCK_QUOTE:
+    return "BlockQuote";
+  }
+  return "Unknown";
+}
+
+} // namespace mt
@@ -0,0 +1,259 @@
+#include "streaming_transpiler.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "block_parser.hpp"
+
+namespace mt {
+
+StreamingTranspiler::StreamingTranspiler(RenderOptions options,
+                                         size_t chunk_size, size_t flush_size)
+    : m_lexer(),
+      m_tokens(),
+      m_document(),
+      m_renderer(std::move(options.title),
+                 options.use_default_style,
+                 options.only_body),
+      m_budget(options.limits),
+      m_active_budget(options.limits.any() ? &m_budget : nullptr),
+      m_stats(nullptr),
+      m_chunk_size(std::max<size_t>(chunk_size, 1)),
+      m_flush_size(flush_size),
+      m_pending(),
+      m_peak_pending_bytes(0),
+      m_stopped(false),
+      m_text_started(false) {
+  m_renderer.set_budget(m_active_budget);
+}
+
+bool StreamingTranspiler::transpile(std::istream &input,
+                                    std::ostream &output) {
+  CallbackSink sink([&output](std::string_view html) {
+    output.write(html.data(), static_cast<std::streamsize>(html.size()));
+    return output.good();
+  });
+  return transpile(input, sink);
+}
+
+bool StreamingTranspiler::transpile(std::istream &input, OutputSink &output) {
+  TimedSink timed_output(output, m_stats ? &m_stats->write : nullptr);
+  m_renderer.set_sink(&timed_output, m_flush_size);
+  bool success = transpile_chunks(input);
+  m_renderer.set_sink(nullptr);
+  return success;
+}
+
+bool StreamingTranspiler::transpile_chunks(std::istream &input) {
+  m_pending.clear();
+  m_peak_pending_bytes = 0;
+  m_stopped = false;
+  m_text_started = false;
+  m_budget.start();
+
+  // Every parse has its own start of file token and Document, but only
+  // one of each exists in the whole input
+  if (m_stats) {
+    m_stats->token_counts[static_cast<size_t>(TokenType::START_OF_FILE)]++;
+    m_stats->node_counts[static_cast<size_t>(NodeKind::DOCUMENT)]++;
+  }
+
+  m_renderer.clear();
+  m_renderer.begin_page();
+  if (!flush())
+    return false;
+
+  // Re-parsing happens only once the pending input doubles since the last
+  // parse which closed no block, keeping huge blocks from being re-parsed
+  // once per chunk
+  size_t parse_threshold = 0;
+  bool is_last = false;
+
+  while (!is_last) {
+    {
+      StageTimer timer(m_stats ? &m_stats->read : nullptr);
+      is_last = !read_chunk(input);
+    }
+    if (input.bad())
+      return false;
+
+    m_peak_pending_bytes = std::max(m_peak_pending_bytes, m_pending.size());
+    if (!is_last && m_pending.size() < parse_threshold)
+      continue;
+
+    // Only whole lines are parsed, until the input ends
+    size_t line_end = m_pending.size();
+    if (!is_last) {
+      size_t last_new_line = m_pending.rfind('\n');
+      if (last_new_line == std::string::npos)
+        continue;
+      line_end = last_new_line + 1;
+    }
+
+    size_t consumed = render_closed_blocks(
+        std::string_view(m_pending).substr(0, line_end), is_last);
+
+    if (consumed == 0) {
+      parse_threshold = m_pending.size() * 2;
+    } else {
+      m_pending.erase(0, consumed);
+      parse_threshold = 0;
+    }
+
+    if (!flush())
+      return false;
+  }
+
+  if (m_text_started)
+    m_renderer.end_text_paragraph();
+  m_renderer.end_page();
+  bool flushed = flush();
+  if (m_stats)
+    m_stats->output_bytes += m_renderer.page_size();
+  return flushed;
+}
+
+bool StreamingTranspiler::read_chunk(std::istream &input) {
+  size_t filled = m_pending.size();
+  m_pending.resize(filled + m_chunk_size);
+  input.read(m_pending.data() + filled,
+             static_cast<std::streamsize>(m_chunk_size));
+
+  size_t read_count = static_cast<size_t>(input.gcount());
+  m_pending.resize(filled + read_count);
+
+  if (m_stats)
+    m_stats->input_bytes += read_count;
+
+  return read_count == m_chunk_size;
+}
+
+// Renders every top-level block of the source which can't be changed by
+// the input that follows, returning the length of the rendered part
+size_t StreamingTranspiler::render_closed_blocks(std::string_view source,
+                                                 bool is_last) {
+  // Past the output limit nothing more gets rendered
+  if (m_budget.status() == Status::OUTPUT_LIMIT)
+    return source.size();
+  if (m_stopped)
+    return render_remaining_text(source, is_last);
+
+  {
+    StageTimer timer(m_stats ? &m_stats->lex : nullptr);
+    m_lexer.reset(source);
+    m_lexer.tokenize(m_tokens);
+  }
+
+  BlockParser parser(m_tokens);
+  parser.set_budget(m_active_budget);
+  {
+    StageTimer timer(m_stats ? &m_stats->parse : nullptr);
+    parser.parse(m_document);
+  }
+
+  // Blocks are closed by the first line which doesn't belong to them,
+  // so every block but the last one is final. The parsing resumes at the
+  // start of a line, just like it would without the split
+  const auto &block_starts = parser.block_starts();
+  size_t closed_count = block_starts.size();
+  size_t resume_token = m_tokens.size();
+  size_t consumed = source.size();
+
+  // Once stopped at a limit, the rest of the input goes into a paragraph
+  // spanning the chunks that follow, rendered without the parser
+  if (parser.stopped()) {
+    closed_count = 0;
+    while (closed_count < block_starts.size() &&
+           m_tokens.offset(block_starts[closed_count]) < parser.stop_offset())
+      closed_count++;
+    m_stopped = true;
+  } else if (!is_last) {
+    closed_count = 0;
+    for (size_t block = block_starts.size(); block-- > 1;) {
+      size_t offset = m_tokens.offset(block_starts[block]);
+      if (source[offset - 1] == '\n') {
+        closed_count = block;
+        resume_token = block_starts[block];
+        consumed = offset;
+        break;
+      }
+    }
+
+    if (closed_count == 0)
+      return 0;
+  }
+
+  {
+    StageTimer timer(m_stats ? &m_stats->render : nullptr,
+                     m_stats ? &m_stats->write : nullptr);
+    m_renderer.render_blocks(m_document, closed_count);
+  }
+
+  m_budget.add_tokens(resume_token - 1);
+
+  if (m_stats) {
+    m_stats->count_tokens(m_tokens, 1, resume_token);
+    const Node *block = m_document.first_child;
+    for (size_t index = 0; index < closed_count; ++index) {
+      m_stats->count_nodes(*block);
+      block = block->next_sibling;
+    }
+  }
+
+  if (m_stopped)
+    return parser.stop_offset() +
+           render_remaining_text(source.substr(parser.stop_offset()), is_last);
+  return consumed;
+}
+
+// Renders the source as the text of the trailing paragraph, returning the
+// length of the rendered part. Like the whole input's paragraph, it leaves
+// out the blank lines around the text, so trailing ones wait for more text
+size_t StreamingTranspiler::render_remaining_text(std::string_view source,
+                                                  bool is_last) {
+  constexpr std::string_view blank = " \t\r\n";
+
+  size_t begin = 0;
+  if (!m_text_started) {
+    begin = source.find_first_not_of(blank);
+    if (begin == std::string_view::npos)
+      return source.size();
+
+    m_text_started = true;
+    m_renderer.begin_text_paragraph();
+    if (m_stats) {
+      m_stats->node_counts[static_cast<size_t>(NodeKind::PARAGRAPH)]++;
+      m_stats->node_counts[static_cast<size_t>(NodeKind::TEXT)]++;
+    }
+  }
+
+  size_t end = source.find_last_not_of(blank);
+  end = end == std::string_view::npos || end < begin ? begin : end + 1;
+
+  {
+    StageTimer timer(m_stats ? &m_stats->render : nullptr,
+                     m_stats ? &m_stats->write : nullptr);
+    m_renderer.render_text(source.substr(begin, end - begin));
+  }
+
+  return is_last ? source.size() : end;
+}
+
+// Timed by the sink, like the flushes during the rendering
+bool StreamingTranspiler::flush() {
+  return m_renderer.flush();
+}
+
+void StreamingTranspiler::set_stats(TranspileStats *stats) {
+  m_stats = stats;
+}
+
+size_t StreamingTranspiler::peak_pending_bytes() const {
+  return m_peak_pending_bytes;
+}
+
+Status StreamingTranspiler::status() const {
+  return m_budget.status();
+}
+
+} // namespace mt
@@ -0,0 +1,40 @@
+#include "token_stream.hpp"
+
+#include <algorithm>
+
+namespace mt {
+
+TokenStream::TokenStream(std::string_view source)
+    : m_source(source) {
+}
+
+void TokenStream::reset(std::string_view source) {
+  m_source = source;
+  m_types.clear();
+  m_offsets.clear();
+  m_lengths.clear();
+  m_new_lines.clear();
+  m_new_lines_found = false;
+}
+
+void TokenStream::reserve(size_t token_count) {
+  m_types.reserve(token_count);
+  m_offsets.reserve(token_count);
+  m_lengths.reserve(token_count);
+}
+
+size_t TokenStream::line_at(size_t index) const {
+  if (!m_new_lines_found) {
+    for (size_t offset = m_source.find('\n'); offset != std::string_view::npos;
+         offset = m_source.find('\n', offset + 1))
+      m_new_lines.push_back(static_cast<uint32_t>(offset));
+    m_new_lines_found = true;
+  }
+
+  // A NEW_LINE token belongs to the line it ends
+  auto preceding_new_lines = std::lower_bound(
+      m_new_lines.begin(), m_new_lines.end(), m_offsets[index]);
+  return static_cast<size_t>(preceding_new_lines - m_new_lines.begin()) + 1;
+}
+
+} // namespace mt
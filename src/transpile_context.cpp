@@ -0,0 +1,90 @@
+#include "transpile_context.hpp"
+
+#include <utility>
+
+#include "block_parser.hpp"
+
+namespace mt {
+
+TranspileContext::TranspileContext(RenderOptions options)
+    : m_lexer(),
+      m_tokens(),
+      m_document(),
+      m_renderer(std::move(options.title),
+                 options.use_default_style,
+                 options.only_body),
+      m_budget(options.limits),
+      m_active_budget(options.limits.any() ? &m_budget : nullptr),
+      m_stats(nullptr) {
+  m_renderer.set_budget(m_active_budget);
+}
+
+std::string_view TranspileContext::render(std::string_view markdown) {
+  m_renderer.set_sink(nullptr);
+  return transpile(markdown);
+}
+
+bool TranspileContext::render(std::string_view markdown, OutputSink &sink,
+                              size_t flush_size) {
+  TimedSink timed_sink(sink, m_stats ? &m_stats->write : nullptr);
+  m_renderer.set_sink(&timed_sink, flush_size);
+  transpile(markdown);
+  bool written = m_renderer.flush();
+  m_renderer.set_sink(nullptr);
+  return written;
+}
+
+std::string_view TranspileContext::transpile(std::string_view markdown) {
+  m_budget.start();
+
+  // 1. Lexing
+  {
+    StageTimer timer(m_stats ? &m_stats->lex : nullptr);
+    m_lexer.reset(markdown);
+    m_lexer.tokenize(m_tokens);
+  }
+
+  // 2. Parsing
+  // The previous tree is released at once, its arena kept for this one
+  {
+    StageTimer timer(m_stats ? &m_stats->parse : nullptr);
+    BlockParser parser(m_tokens);
+    parser.set_budget(m_active_budget);
+    parser.parse(m_document);
+  }
+
+  // 3. Rendering, along with the writes into the sink, timed apart
+  std::string_view html;
+  {
+    StageTimer timer(m_stats ? &m_stats->render : nullptr,
+                     m_stats ? &m_stats->write : nullptr);
+    html = m_renderer.render(m_document);
+  }
+
+  if (m_stats) {
+    m_stats->count_tokens(m_tokens);
+    m_stats->count_nodes(m_document);
+    m_stats->input_bytes += markdown.size();
+    m_stats->output_bytes += m_renderer.page_size();
+  }
+
+  return html;
+}
+
+void TranspileContext::set_title(std::string title) {
+  m_renderer.set_title(std::move(title));
+}
+
+void TranspileContext::set_stats(TranspileStats *stats) {
+  m_stats = stats;
+}
+
+const Document *TranspileContext::document() const {
+  return &m_document;
+}
+
+Status TranspileContext::status() const {
+  return m_budget.status();
+}
+
+} // namespace mt
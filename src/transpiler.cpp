@@ -1,19 +1,25 @@
 #include "transpiler.hpp"
 
+#include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <sstream>
 
-#include "block_parser.hpp"
-#include "html_renderer.hpp"
-#include "lexer.hpp"
+#include "file_watcher.hpp"
+#include "input_file.hpp"
+#include "output_sink.hpp"
+#include "render_server.hpp"
+#include "streaming_transpiler.hpp"
+#include "token_stream.hpp"
 
 namespace mt {
 
+namespace fs = std::filesystem;
+
 int Transpiler::run(int argc, char *argv[]) {
-  bool use_default_styling = true;
-  bool only_body = false;
+  TranspilerOptions options;
   std::string input_filename;
   std::string output_filename;
 
@@ -21,10 +27,55 @@ int Transpiler::run(int argc, char *argv[]) {
   for (int i = 1; i < argc; ++i) {
     std::string arg = argv[i];
     if (arg == "--no-styling") {
-      use_default_styling = false;
+      options.use_default_styling = false;
     } else if (arg == "--only-body") {
-      use_default_styling = false;
-      only_body = true;
+      options.use_default_styling = false;
+      options.only_body = true;
+    } else if (arg == "--stream") {
+      options.stream = true;
+    } else if (arg == "--batch") {
+      options.batch = true;
+    } else if (arg.starts_with("--jobs=")) {
+      if (!parse_number(arg, options.jobs))
+        return 1;
+    } else if (arg == "--cache") {
+      options.cache_directory = BuildCache::default_directory;
+    } else if (arg.starts_with("--cache=")) {
+      options.cache_directory = arg.substr(std::string_view("--cache=").size());
+    } else if (arg == "--watch") {
+      options.watch = true;
+    } else if (arg.starts_with("--debounce-ms=")) {
+      if (!parse_number(arg, options.debounce_ms))
+        return 1;
+    } else if (arg == "--serve") {
+      options.serve = true;
+    } else if (arg.starts_with("--serve=")) {
+      options.serve = true;
+      options.serve_socket = arg.substr(std::string_view("--serve=").size());
+    } else if (arg == "--stats") {
+      options.stats_format = StatsFormat::TEXT;
+    } else if (arg == "--stats=json") {
+      options.stats_format = StatsFormat::JSON;
+    } else if (arg.starts_with("--max-depth=") ||
+               arg.starts_with("--max-tokens=") ||
+               arg.starts_with("--max-output=") ||
+               arg.starts_with("--deadline-ms=")) {
+      size_t limit = 0;
+      if (!parse_number(arg, limit))
+        return 1;
+
+      Limits &limits = options.limits;
+      if (arg.starts_with("--max-depth="))
+        limits.max_depth = limit;
+      else if (arg.starts_with("--max-tokens="))
+        limits.max_tokens = limit;
+      else if (arg.starts_with("--max-output="))
+        limits.max_output_bytes = limit;
+      else
+        limits.deadline = std::chrono::milliseconds(limit);
+    } else if (arg.starts_with("--threads=")) {
+      if (!parse_number(arg, options.threads))
+        return 1;
     } else if (arg.substr(0, 2) == "--") {
       std::cout << "Unknown command: " << arg << '\n';
     } else if (input_filename.empty()) {
@@ -34,9 +85,54 @@ int Transpiler::run(int argc, char *argv[]) {
     }
   }
 
-  if (input_filename.empty()) {
+  if (options.serve) {
+    if (options.batch || options.stream || options.threads != 1 ||
+        options.watch || !options.cache_directory.empty() ||
+        !input_filename.empty()) {
+      std::cerr << "Error: --serve renders requests on their own, without "
+                   "files, --batch, --stream, --threads, --watch or "
+                   "--cache.\n";
+      return 1;
+    }
+    return serve(options);
+  }
+
+  if (input_filename.empty() || (options.batch && output_filename.empty())) {
     std::cout << "Usage: " << argv[0] << " [--no-styling] [--only-body] "
-              << "<input_file> [output_file]\n";
+              << "[--stream] [--threads=N] [--cache[=DIR]] [--stats[=json]] "
+              << "[--watch [--debounce-ms=N]] [--max-depth=N] "
+              << "[--max-tokens=N] [--max-output=BYTES] [--deadline-ms=N] "
+              << "<input_file> [output_file]\n"
+              << "       " << argv[0] << " --batch [--jobs=N] [options] "
+              << "<input_directory> <output_directory>\n"
+              << "       " << argv[0] << " --serve[=SOCKET] [--jobs=N] "
+              << "[--max-depth=N] [--max-tokens=N] [--max-output=BYTES] "
+              << "[--deadline-ms=N]\n";
+    return 1;
+  }
+
+  if (options.batch) {
+    if (options.stream || options.threads != 1) {
+      std::cerr << "Error: --batch transpiles every file on a single thread, "
+                   "without --stream or --threads.\n";
+      return 1;
+    }
+    return transpile_batch(input_filename, output_filename, options);
+  }
+
+  if (options.stream && options.threads != 1) {
+    std::cerr << "Error: --threads only applies to whole files, not to "
+                 "--stream.\n";
+    return 1;
+  }
+  if (options.stream && !options.cache_directory.empty()) {
+    std::cerr << "Error: --cache only applies to whole files, not to "
+                 "--stream.\n";
+    return 1;
+  }
+  if (options.stream && options.watch) {
+    std::cerr << "Error: --watch only applies to whole files, not to "
+                 "--stream.\n";
     return 1;
   }
 
@@ -44,75 +140,309 @@ int Transpiler::run(int argc, char *argv[]) {
   // if .html is missing from the filename
   // add it
   if (output_filename.empty()) {
-    std::filesystem::path input_path(input_filename);
+    fs::path input_path(input_filename);
     output_filename = input_path.stem().string() + ".html";
   } else {
-    std::filesystem::path out_path(output_filename);
+    fs::path out_path(output_filename);
     if (!out_path.has_extension()) {
       out_path += ".html";
       output_filename = out_path.string();
     }
   }
 
-  return transpile(
-             input_filename, output_filename, use_default_styling, only_body)
-             ? 0
-             : 1;
+  if (options.watch)
+    return watch(input_filename, output_filename, options);
+
+  ParallelTranspiler transpiler(render_options(input_filename, options),
+                                options.threads);
+  BuildCache cache(options.cache_directory);
+  Status status = Status::OK;
+  if (!transpile(input_filename, output_filename, options, transpiler,
+                 options.cache_directory.empty() ? nullptr : &cache, status))
+    return 1;
+  return status == Status::OK ? 0 : 2;
+}
+
+// The value of a --name=N option
+bool Transpiler::parse_number(const std::string &arg, size_t &number) {
+  std::string_view value = std::string_view(arg).substr(arg.find('=') + 1);
+  auto [end, error] =
+      std::from_chars(value.data(), value.data() + value.size(), number);
+  if (error != std::errc() || end != value.data() + value.size() ||
+      value.empty()) {
+    std::cerr << "Error: Invalid value: " << arg << "\n";
+    return false;
+  }
+  return true;
+}
+
+// The title of the page is the name of its file
+RenderOptions Transpiler::render_options(const std::string &input_path,
+                                         const TranspilerOptions &options) {
+  return RenderOptions{fs::path(input_path).stem().string(),
+                       options.use_default_styling, options.only_body,
+                       options.limits};
 }
 
 bool Transpiler::transpile(const std::string &input_path,
                            const std::string &output_path,
-                           bool use_custom_style, bool only_body) {
-  std::ifstream file(input_path);
-  if (!file.is_open()) {
-    std::cerr << "Error: Could not open input file: " << input_path << "\n";
+                           const TranspilerOptions &options,
+                           ParallelTranspiler &transpiler,
+                           const BuildCache *cache, Status &status) {
+  TranspileStats stats;
+  TranspileStats *stats_ptr =
+      options.stats_format == StatsFormat::NONE ? nullptr : &stats;
+
+  bool cached = false;
+  bool success =
+      options.stream
+          ? transpile_streaming(input_path, output_path, options, stats_ptr,
+                                status)
+          : transpile_whole(input_path, output_path, options, transpiler,
+                            cache, stats_ptr, status, cached);
+  if (!success)
     return false;
+
+  if (cached)
+    std::cout << "'" << output_path << "' is up to date with '" << input_path
+              << "'.\n";
+  else
+    std::cout << "Successfully transpiled '" << input_path << "' to '"
+              << output_path << "'.\n";
+  if (options.only_body)
+    std::cout << "(Only body)\n";
+  else if (!options.use_default_styling)
+    std::cout << "(Default styling disabled)\n";
+
+  if (status == Status::OUTPUT_LIMIT)
+    std::cerr << "Warning: Stopped at the output limit, the rest of the "
+                 "input was left out.\n";
+  else if (status != Status::OK)
+    std::cerr << "Warning: Stopped at the " << status_name(status)
+              << ", the rest of the input was rendered as text.\n";
+
+  if (options.stats_format == StatsFormat::TEXT)
+    std::cout << stats.to_text();
+  else if (options.stats_format == StatsFormat::JSON)
+    std::cout << stats.to_json();
+
+  return true;
+}
+
+// Serves until standard input ends, or the socket fails
+int Transpiler::serve(const TranspilerOptions &options) {
+  RenderServer server(options.limits, options.jobs);
+  bool served = options.serve_socket.empty()
+                    ? server.serve_stream()
+                    : server.serve_socket(options.serve_socket);
+  return served ? 0 : 1;
+}
+
+// Transpiles the file again whenever it's saved, the transpiler and the
+// cache keeping their buffers and entries between runs
+int Transpiler::watch(const std::string &input_path,
+                      const std::string &output_path,
+                      const TranspilerOptions &options) {
+  // Editors often replace the file rather than write to it, so the whole
+  // directory is watched
+  fs::path input(input_path);
+  fs::path directory = input.has_parent_path() ? input.parent_path() : ".";
+  FileWatcher watcher;
+  if (!watcher.watch(directory, false)) {
+    std::cerr << "Error: Could not watch directory: " << directory.string()
+              << "\n";
+    return 1;
   }
 
-  std::stringstream buffer;
-  buffer << file.rdbuf();
-  std::string source = buffer.str();
+  ParallelTranspiler transpiler(render_options(input_path, options),
+                                options.threads);
+  BuildCache cache(options.cache_directory);
+  Status status = Status::OK;
+  transpile(input_path, output_path, options, transpiler, &cache, status);
+  std::cout << "Watching '" << input_path << "' for changes.\n"
+            << std::flush;
 
-  // 1. Lexing
-  Lexer lexer(source);
-  auto tokens = lexer.tokenize();
+  std::vector<fs::path> changed;
+  while (watcher.wait(changed,
+                      std::chrono::milliseconds(options.debounce_ms))) {
+    bool input_changed =
+        std::any_of(changed.begin(), changed.end(), [&](const fs::path &path) {
+          return path == directory || path.filename() == input.filename();
+        });
+    if (input_changed) {
+      transpile(input_path, output_path, options, transpiler, &cache, status);
+      std::cout << std::flush;
+    }
+  }
 
-  if (tokens.empty() && !source.empty()) {
-    std::cerr << "Error: Lexing failed.\n";
+  std::cerr << "Error: Could not watch directory: " << directory.string()
+            << "\n";
+  return 1;
+}
+
+// Exits with 1 when any file failed, or else 2 when any hit a limit. When
+// watching, only the files changed are transpiled again
+int Transpiler::transpile_batch(const std::string &input_directory,
+                                const std::string &output_directory,
+                                const TranspilerOptions &options) {
+  // Watched before the first run, so that no change is missed
+  FileWatcher watcher;
+  if (options.watch && !watcher.watch(input_directory, true)) {
+    std::cerr << "Error: Could not watch directory: " << input_directory
+              << "\n";
+    return 1;
+  }
+
+  TranspileStats stats;
+  BatchTranspiler transpiler(RenderOptions{std::string(),
+                                           options.use_default_styling,
+                                           options.only_body, options.limits},
+                             options.jobs);
+  if (options.stats_format != StatsFormat::NONE)
+    transpiler.set_stats(&stats);
+  BuildCache cache(options.cache_directory);
+  if (!options.cache_directory.empty() || options.watch)
+    transpiler.set_cache(&cache);
+
+  if (!transpiler.transpile(input_directory, output_directory))
+    return 1;
+  int exit_code = report_batch(transpiler, input_directory, output_directory,
+                               options, stats);
+  if (!options.watch)
+    return exit_code;
+
+  std::cout << "Watching '" << input_directory << "' for changes.\n"
+            << std::flush;
+  std::vector<fs::path> changed;
+  while (watcher.wait(changed,
+                      std::chrono::milliseconds(options.debounce_ms))) {
+    stats = TranspileStats();
+    transpiler.transpile(input_directory, output_directory, changed);
+    if (transpiler.summary().file_count != 0) {
+      report_batch(transpiler, input_directory, output_directory, options,
+                   stats);
+      std::cout << std::flush;
+    }
+  }
+
+  std::cerr << "Error: Could not watch directory: " << input_directory
+            << "\n";
+  return 1;
+}
+
+int Transpiler::report_batch(const BatchTranspiler &transpiler,
+                             const std::string &input_directory,
+                             const std::string &output_directory,
+                             const TranspilerOptions &options,
+                             const TranspileStats &stats) {
+  const BatchSummary &summary = transpiler.summary();
+  double megabytes = static_cast<double>(summary.input_bytes) / 1e6;
+  std::cout << "Transpiled " << summary.file_count - summary.failed_count
+            << " of " << summary.file_count << " files from '"
+            << input_directory << "' to '" << output_directory << "'";
+  if (summary.cached_count != 0)
+    std::cout << ", " << summary.cached_count << " of them up to date";
+  std::cout << ".\n"
+            << megabytes << " MB in " << summary.seconds << " s ("
+            << (summary.seconds > 0 ? megabytes / summary.seconds : 0.0)
+            << " MB/s), " << summary.output_bytes << " bytes written.\n";
+
+  if (summary.limited_count != 0)
+    std::cerr << "Warning: " << summary.limited_count
+              << " files stopped at a limit.\n";
+
+  if (options.stats_format == StatsFormat::TEXT)
+    std::cout << stats.to_text();
+  else if (options.stats_format == StatsFormat::JSON)
+    std::cout << stats.to_json();
+
+  if (summary.failed_count != 0)
+    return 1;
+  return summary.limited_count == 0 ? 0 : 2;
+}
+
+bool Transpiler::transpile_whole(const std::string &input_path,
+                                 const std::string &output_path,
+                                 const TranspilerOptions &options,
+                                 ParallelTranspiler &transpiler,
+                                 const BuildCache *cache,
+                                 TranspileStats *stats, Status &status,
+                                 bool &cached) {
+  InputFile input_file;
+  {
+    StageTimer timer(stats ? &stats->read : nullptr);
+    if (!input_file.open(input_path)) {
+      std::cerr << "Error: Could not open input file: " << input_path << "\n";
+      return false;
+    }
+  }
+  std::string_view source = input_file.contents();
+
+  if (source.size() > TokenStream::max_source_size) {
+    std::cerr << "Error: Lexing failed, the input is larger than 4 GiB "
+                 "(see --stream).\n";
     return false;
   }
 
-  // 2. Parsing
-  BlockParser parser(tokens);
-  auto document = parser.parse();
-  if (!document) {
-    std::cerr << "Error: Parsing failed.\n";
+  // An output file rendered from the same input is left untouched
+  uint64_t cache_key = 0;
+  if (cache) {
+    cache_key = BuildCache::key(source, render_options(input_path, options));
+    cached = cache->lookup(output_path, cache_key, status);
+    if (cached)
+      return true;
+  }
+
+  // The page is written out as it's rendered, never held whole
+  FileSink out_file;
+  if (!out_file.open(output_path)) {
+    std::cerr << "Error: Could not open output file: " << output_path << "\n";
     return false;
   }
 
-  std::filesystem::path p(input_path);
-  std::string doc_title = p.stem().string();
+  transpiler.set_stats(stats);
+  bool written = transpiler.transpile(source, out_file);
+  status = transpiler.status();
+  out_file.close();
 
-  // 3. Rendering
-  HtmlRenderer renderer(doc_title, use_custom_style, only_body);
-  document->accept(renderer);
-  std::string html_content = renderer.get_output();
+  if (!written) {
+    std::cerr << "Error: Could not write output file: " << output_path
+              << "\n";
+    return false;
+  }
+
+  if (cache && !cache->store(output_path, cache_key, status))
+    std::cerr << "Warning: Could not write the build cache in '"
+              << options.cache_directory << "'.\n";
+  return true;
+}
 
-  // 4. Output
-  std::ofstream out_file(output_path);
-  if (!out_file.is_open()) {
+bool Transpiler::transpile_streaming(const std::string &input_path,
+                                     const std::string &output_path,
+                                     const TranspilerOptions &options,
+                                     TranspileStats *stats, Status &status) {
+  std::ifstream in_file(input_path, std::ios::binary);
+  if (!in_file.is_open()) {
+    std::cerr << "Error: Could not open input file: " << input_path << "\n";
+    return false;
+  }
+
+  FileSink out_file;
+  if (!out_file.open(output_path)) {
     std::cerr << "Error: Could not open output file: " << output_path << "\n";
     return false;
   }
 
-  out_file << html_content;
-  std::cout << "Successfully transpiled '" << input_path << "' to '"
-            << output_path << "'.\n";
-  if (only_body)
-    std::cout << "(Only body)\n";
-  else if (!use_custom_style)
-    std::cout << "(Default styling disabled)\n";
+  StreamingTranspiler transpiler(render_options(input_path, options));
+  transpiler.set_stats(stats);
+
+  if (!transpiler.transpile(in_file, out_file)) {
+    std::cerr << "Error: Streaming '" << input_path << "' to '" << output_path
+              << "' failed.\n";
+    return false;
+  }
 
+  status = transpiler.status();
   return true;
 }
 
@@ -0,0 +1,182 @@
+/*
+  Transpile equivalence test: every way of transpiling a document has to
+  give the same HTML as TranspileContext::render() over the whole of it
+*/
+#include <cstddef>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "budget.hpp"
+#include "corpus_generator.hpp"
+#include "editable_document.hpp"
+#include "output_sink.hpp"
+#include "parallel_transpiler.hpp"
+#include "streaming_transpiler.hpp"
+#include "transpile_context.hpp"
+
+namespace {
+
+struct Sample {
+  std::string name;
+  std::string markdown;
+};
+
+// Blocks which span lines in every way the block parser handles: fences
+// holding blank lines and markers, nested lists and quotes, and lazy
+// continuation lines of paragraphs inside them
+constexpr std::string_view blocks[] = {
+    "# Heading with *emphasis*\n\n",
+    "A paragraph of **strong** text\nwith a second line & a [link](a.md)\n\n",
+    "```cpp\nint main() {\n\n  return 1 < 2;\n}\n- not a list\n```\n\n",
+    "- item\n  - nested item\n    - deeper item\n  continued lazily\n"
+    "- last item\n\n",
+    "> quote\n> > nested quote\nlazy continuation\n> back in the quote\n\n",
+    "> - list in a quote\n>   ```\n>   code in its item\n>   ```\n\n",
+    "1. not ordered\n* star item with `code`\n\n",
+    "Text <b>with</b> 'quotes' \"around\"\r\nand a carriage return\r\n\r\n",
+    "```\nfence left open",
+};
+
+std::string make_markdown(size_t size) {
+  std::string markdown;
+  for (size_t index = 0; markdown.size() < size; ++index) {
+    // The open fence only ever ends the document
+    size_t block = index % (std::size(blocks) - 1);
+    markdown += blocks[block];
+    if (index % 7 == 0)
+      markdown += "paragraph number " + std::to_string(index) + "\n\n";
+  }
+  markdown += blocks[std::size(blocks) - 1];
+  return markdown;
+}
+
+std::vector<Sample> samples() {
+  std::vector<Sample> samples = {
+      {"empty", ""},
+      {"small", make_markdown(1)},
+      {"medium", make_markdown(64 * 1024)},
+      {"large", make_markdown(1024 * 1024)},
+  };
+  // Along with the benchmark's corpora, each stressing one kind of block
+  for (auto kind : mt::bench::all_corpus_kinds()) {
+    auto corpus = mt::bench::generate_corpus(kind, 512 * 1024, 1);
+    samples.push_back({std::string(corpus.name), std::move(corpus.source)});
+  }
+  return samples;
+}
+
+int failures = 0;
+
+void check(bool passed, std::string_view what, const Sample &sample) {
+  if (passed)
+    return;
+  failures++;
+  std::cerr << "FAILED: " << what << " differs for " << sample.name << '\n';
+}
+
+std::string render_whole(const Sample &sample,
+                         const mt::RenderOptions &options) {
+  mt::TranspileContext context(options);
+  return std::string(context.render(sample.markdown));
+}
+
+std::string render_streaming(const Sample &sample,
+                             const mt::RenderOptions &options,
+                             size_t chunk_size) {
+  mt::StreamingTranspiler transpiler(options, chunk_size, 1024);
+  std::istringstream input(sample.markdown);
+  std::ostringstream output;
+  transpiler.transpile(input, output);
+  return output.str();
+}
+
+void check_streaming(const Sample &sample, const mt::RenderOptions &options,
+                     std::string_view what) {
+  std::string expected = render_whole(sample, options);
+  for (size_t chunk_size : {1, 7, 4096, 1024 * 1024}) {
+    // Single bytes only for the smaller samples, to keep the test quick
+    if (chunk_size < 4096 && sample.markdown.size() > 64 * 1024)
+      continue;
+    check(render_streaming(sample, options, chunk_size) == expected, what,
+          sample);
+  }
+}
+
+// Documents under ParallelTranspiler::min_part_size stay on one thread
+void check_threaded(const Sample &sample, const mt::RenderOptions &options,
+                    std::string_view what) {
+  std::string expected = render_whole(sample, options);
+  for (size_t thread_count : {1, 2, 4}) {
+    mt::ParallelTranspiler transpiler(options, thread_count);
+    mt::BufferSink output;
+    transpiler.transpile(sample.markdown, output);
+    check(output.view() == expected, what, sample);
+  }
+}
+
+// Edits opening and closing the blocks spanning lines, so that the parts
+// re-parsed have to grow over the parts after them
+constexpr std::string_view edits[] = {
+    "```\n", "\n", "> ", "- ", "  - ", "lazy line\n", "# ", "", "\n\n",
+};
+
+void check_editable(const Sample &sample, const mt::RenderOptions &options) {
+  mt::EditableDocument document(options, 256);
+  document.set_text(sample.markdown);
+  check(document.render() == render_whole(sample, options), "editable",
+        sample);
+
+  // Edits are only checked on the smaller samples, every one of them
+  // rendering the whole text again
+  if (sample.markdown.size() > 128 * 1024)
+    return;
+
+  for (size_t index = 0; index < 64; ++index) {
+    size_t size = document.size();
+    size_t begin = size ? (index * 7919) % size : 0;
+    size_t end = begin + index % 3 * (index % 5);
+    document.edit(begin, end, edits[index % std::size(edits)]);
+
+    Sample edited{sample.name + " after edit " + std::to_string(index),
+                  document.text()};
+    check(document.render() == render_whole(edited, options), "editable",
+          edited);
+  }
+}
+
+// Limits which stop the parsing partway, leaving the rest of the input as
+// one paragraph of text
+std::vector<mt::Limits> limits() {
+  std::vector<mt::Limits> limits(3);
+  limits[0].max_tokens = 1000;
+  limits[1].max_depth = 2;
+  limits[2].max_output_bytes = 20 * 1024;
+  return limits;
+}
+
+} // namespace
+
+int main() {
+  mt::RenderOptions options{"test"};
+
+  for (const Sample &sample : samples()) {
+    check_streaming(sample, options, "streaming");
+    check_threaded(sample, options, "threaded");
+    check_editable(sample, options);
+    for (const mt::Limits &limit : limits()) {
+      mt::RenderOptions limited = options;
+      limited.limits = limit;
+      check_streaming(sample, limited, "streaming with a limit");
+      check_threaded(sample, limited, "threaded with a limit");
+    }
+  }
+
+  if (failures) {
+    std::cerr << failures << " checks failed\n";
+    return 1;
+  }
+  return 0;
+}